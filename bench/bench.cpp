@@ -0,0 +1,437 @@
+#include <bits/stdc++.h>
+#include "../include/slowjson.hpp"
+
+// Throughput of read, tokenize, parse, parse_direct (with eager and lazy
+// numbers), validate, parse_parallel and ndjson batches over generated
+// corpora, or over files given on the command line. Corpora come from a
+// fixed seed, so runs of different versions parse the same bytes; results
+// can be written as json (--json) to diff them.
+
+struct corpus {
+    std::string name;
+    std::vector<std::string> docs;
+
+    size_t
+    bytes() const {
+        size_t n = 0;
+        for (const std::string &d : docs)
+            n += d.size();
+        return n;
+    }
+};
+
+// std::mt19937 output is fixed by the standard, its distributions are not,
+// so every draw goes through here.
+struct generator {
+    std::mt19937_64 rng;
+
+    explicit generator(uint64_t seed) : rng(seed) {}
+
+    uint64_t
+    below(uint64_t n) {
+        return rng() % n;
+    }
+
+    std::string
+    word() {
+        static const char *words[] = {
+            "json", "fast", "parse", "the", "of", "coffee", "train",
+            "morning", "release", "caf\\u00e9", "\xe6\x97\xa5\xe6\x9c\xac",
+            "\\\"quoted\\\"", "new\\nline", "data", "stream", "http"};
+        return words[below(sizeof(words) / sizeof(words[0]))];
+    }
+
+    std::string
+    sentence(size_t words) {
+        std::string s;
+        for (size_t i = 0; i < words; ++i) {
+            if (i)
+                s += ' ';
+            s += word();
+        }
+        return s;
+    }
+
+    // A double printed with 15 to 17 significant digits.
+    std::string
+    coordinate(double low, double high) {
+        double v = low + (high - low) * double(below(1u << 30)) / (1u << 30);
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.*g", int(15 + below(3)), v);
+        return buffer;
+    }
+};
+
+// Statuses with nested users and entities, like a search API response.
+static corpus
+make_twitter(double scale) {
+    generator g(1);
+    size_t count = std::max<size_t>(1, size_t(4000 * scale));
+    std::string s = "{\"statuses\":[";
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t id = 500000000000000000ull + g.below(1ull << 50);
+        std::string n = std::to_string(id);
+        if (i)
+            s += ',';
+        s += "{\"created_at\":\"Sun Aug 31 00:29:15 +0000 2014\",\"id\":" + n +
+             ",\"id_str\":\"" + n + "\",\"text\":\"" +
+             g.sentence(5 + g.below(15)) +
+             "\",\"truncated\":false,\"in_reply_to_status_id\":null,"
+             "\"user\":{\"id\":" +
+             std::to_string(g.below(1u << 31)) + ",\"name\":\"" + g.word() +
+             "\",\"screen_name\":\"user" + std::to_string(g.below(100000)) +
+             "\",\"description\":\"" + g.sentence(g.below(12)) +
+             "\",\"followers_count\":" + std::to_string(g.below(100000)) +
+             ",\"verified\":" + (g.below(10) ? "false" : "true") +
+             ",\"profile_image_url\":\"http:\\/\\/pbs.twimg.com\\/profile_"
+             "images\\/" +
+             std::to_string(g.below(1u << 30)) +
+             "\\/normal.jpeg\"},\"entities\":{\"hashtags\":[";
+        for (uint64_t h = g.below(3); h; --h)
+            s += "{\"text\":\"" + g.word() + "\",\"indices\":[" +
+                 std::to_string(g.below(100)) + ',' +
+                 std::to_string(g.below(100)) + "]}" + (h > 1 ? "," : "");
+        s += "],\"urls\":[]},\"retweet_count\":" +
+             std::to_string(g.below(1000)) +
+             ",\"favorited\":false,\"lang\":\"ja\",\"geo\":null}";
+    }
+    s += "],\"search_metadata\":{\"completed_in\":0.087,\"count\":" +
+         std::to_string(count) + "}}";
+    return corpus{"twitter", {s}};
+}
+
+// Polygons of floating-point coordinates, like a GeoJSON country outline.
+static corpus
+make_canada(double scale) {
+    generator g(2);
+    size_t rings = std::max<size_t>(1, size_t(400 * scale));
+    std::string s = "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":"
+                    "\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+                    "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[";
+    for (size_t r = 0; r < rings; ++r) {
+        s += r ? ",[" : "[";
+        for (size_t p = 0, points = 20 + g.below(200); p < points; ++p) {
+            if (p)
+                s += ',';
+            s += '[' + g.coordinate(-141, -52) + ',' + g.coordinate(41, 83) +
+                 ']';
+        }
+        s += ']';
+    }
+    s += "]}}]}";
+    return corpus{"canada", {s}};
+}
+
+// Chains of objects and arrays nested hundreds of levels deep.
+static corpus
+make_deep(double scale) {
+    generator g(3);
+    size_t chains = std::max<size_t>(1, size_t(400 * scale));
+    std::string s = "[";
+    for (size_t c = 0; c < chains; ++c) {
+        size_t depth = 200 + g.below(800);
+        if (c)
+            s += ',';
+        for (size_t d = 0; d < depth; ++d)
+            s += d % 2 ? "[" : "{\"a\":";
+        s += std::to_string(g.below(1000));
+        for (size_t d = depth; d-- > 0;)
+            s += d % 2 ? "]" : "}";
+    }
+    s += ']';
+    return corpus{"deep", {s}};
+}
+
+// Few values, each a string of tens of kilobytes with some escapes.
+static corpus
+make_long_strings(double scale) {
+    generator g(4);
+    size_t count = std::max<size_t>(1, size_t(64 * scale));
+    std::string s = "{\"pages\":[";
+    for (size_t i = 0; i < count; ++i) {
+        if (i)
+            s += ',';
+        s += "{\"title\":\"" + g.sentence(4) + "\",\"body\":\"";
+        for (size_t n = 16384 + g.below(65536); n; --n) {
+            uint64_t k = g.below(200);
+            if (k == 0)
+                s += "\\n";
+            else if (k == 1)
+                s += "\\\"";
+            else if (k == 2)
+                s += "\\u00e9";
+            else
+                s += char('a' + k % 26);
+        }
+        s += "\"}";
+    }
+    s += "]}";
+    return corpus{"long_strings", {s}};
+}
+
+// Many separate small documents, like the lines of a log.
+static corpus
+make_small_docs(double scale) {
+    generator g(5);
+    size_t count = std::max<size_t>(1, size_t(20000 * scale));
+    corpus c{"small_docs", {}};
+    c.docs.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        c.docs.push_back("{\"id\":" + std::to_string(i) + ",\"ts\":" +
+                         std::to_string(1400000000 + g.below(100000000)) +
+                         ",\"level\":\"" + (g.below(4) ? "info" : "warn") +
+                         "\",\"msg\":\"" + g.sentence(1 + g.below(6)) +
+                         "\",\"value\":" + g.coordinate(0, 1000) +
+                         ",\"ok\":true,\"tags\":[\"a\",\"b\"]}");
+    return c;
+}
+
+static corpus
+load_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("bad file");
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return corpus{path, {ss.str()}};
+}
+
+static const char *phases[] = {"read",         "tokenize",
+                               "parse",        "parse_direct",
+                               "lazy_numbers", "validate",
+                               "parallel",     "ndjson"};
+static const size_t phase_count = sizeof(phases) / sizeof(phases[0]);
+static const size_t ndjson_phase = 7;
+
+struct result {
+    std::string corpus;
+    std::string phase;
+    size_t bytes;
+    size_t docs;
+    std::vector<double> seconds; // One per repetition
+};
+
+static double
+median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// Time every phase over all documents of c, once per repetition after the
+// warm-up ones. A phase runs over every document before the next starts,
+// so each is timed as a whole rather than document by document. The
+// parallel phase runs parse_parallel() on a pool of threads, which only
+// splits documents of a MiB or more. The ndjson phase parses the documents as the lines of one text, on threads;
+// it is left out for a single document.
+static void
+run(const corpus &c, int warmup, int reps, unsigned threads,
+    std::vector<result> &out) {
+    std::vector<ecl::json_storage> storage(c.docs.size());
+    std::vector<result> r(phase_count);
+    for (size_t p = 0; p < phase_count; ++p)
+        r[p] = result{c.name, phases[p], c.bytes(), c.docs.size(), {}};
+    ecl::thread_pool pool(threads);
+    ecl::ndjson_batch batch(threads);
+    std::string lines;
+    for (const std::string &d : c.docs)
+        lines += d + '\n';
+    for (int rep = -warmup; rep < reps; ++rep) {
+        for (size_t p = 0; p < phase_count; ++p) {
+            auto start = std::chrono::steady_clock::now();
+            if (p == ndjson_phase && c.docs.size() > 1) {
+                std::atomic<size_t> parsed(0);
+                batch.for_each(lines, [&](size_t, ecl::json_storage &) {
+                    ++parsed;
+                });
+                if (parsed != c.docs.size())
+                    throw std::runtime_error("ndjson records lost");
+            }
+            for (size_t i = 0; p != ndjson_phase && i < c.docs.size(); ++i) {
+                ecl::json_storage &js = storage[i];
+                switch (p) {
+                case 0: {
+                    js.read(c.docs[i]);
+                } break;
+                case 1: {
+                    js.tokenize();
+                } break;
+                case 2: {
+                    js.parse();
+                } break;
+                case 3: {
+                    js.parse_direct();
+                } break;
+                case 4: {
+                    js.set_lazy_numbers(true);
+                    js.parse_direct();
+                    js.set_lazy_numbers(false);
+                } break;
+                case 5: {
+                    ecl::validation_result v = js.validate();
+                    if (!v)
+                        throw std::runtime_error(v.error);
+                } break;
+                case 6: {
+                    js.parse_parallel(pool);
+                } break;
+                default:
+                    break;
+                }
+            }
+            std::chrono::duration<double> took =
+                std::chrono::steady_clock::now() - start;
+            if (rep >= 0)
+                r[p].seconds.push_back(took.count());
+        }
+    }
+    if (c.docs.size() == 1)
+        r.erase(r.begin() + ndjson_phase);
+    out.insert(out.end(), r.begin(), r.end());
+}
+
+static void
+write_json(const std::vector<result> &results, int warmup, int reps,
+           unsigned threads, double scale, const std::string &label,
+           std::string &out) {
+    static const char *levels[] = {"scalar", "sse4.2", "avx2"};
+    ecl::json_writer w(out, 2);
+    w.start_object();
+    w.key("label");
+    w.string(label);
+    w.key("compiler");
+    w.string(__VERSION__);
+    w.key("simd");
+    w.string(levels[ecl::structural_index::best_level()]);
+    w.key("scale");
+    w.float64(scale);
+    w.key("warmup");
+    w.int64(warmup);
+    w.key("reps");
+    w.int64(reps);
+    w.key("threads");
+    w.int64(threads);
+    w.key("results");
+    w.start_array();
+    for (const result &r : results) {
+        double m = median(r.seconds);
+        w.start_object();
+        w.key("corpus");
+        w.string(r.corpus);
+        w.key("phase");
+        w.string(r.phase);
+        w.key("bytes");
+        w.int64(r.bytes);
+        w.key("docs");
+        w.int64(r.docs);
+        w.key("median_s");
+        w.float64(m);
+        w.key("min_s");
+        w.float64(*std::min_element(r.seconds.begin(), r.seconds.end()));
+        w.key("mb_per_s");
+        w.float64(r.bytes / m / 1e6);
+        w.key("docs_per_s");
+        w.float64(r.docs / m);
+        w.key("seconds");
+        w.start_array();
+        for (double s : r.seconds)
+            w.float64(s);
+        w.end_array();
+        w.end_object();
+    }
+    w.end_array();
+    w.end_object();
+    out += '\n';
+}
+
+static void
+usage(const char *self) {
+    fprintf(stderr,
+            "usage: %s [--reps N] [--warmup N] [--scale X] [--only NAME]\n"
+            "          [--threads N] [--label TEXT] [--json FILE|-]\n"
+            "          [file.json...]\n"
+            "Files replace the generated corpora; --scale sizes those "
+            "(1 is a few MB each).\n",
+            self);
+}
+
+int
+main(int argc, char **argv) {
+    int reps = 5, warmup = 1;
+    unsigned threads = 4;
+    double scale = 1;
+    std::string json_path, label, only;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_value = i + 1 < argc;
+        if (a == "--reps" && has_value)
+            reps = std::max(1, atoi(argv[++i]));
+        else if (a == "--warmup" && has_value)
+            warmup = std::max(0, atoi(argv[++i]));
+        else if (a == "--scale" && has_value)
+            scale = atof(argv[++i]);
+        else if (a == "--json" && has_value)
+            json_path = argv[++i];
+        else if (a == "--label" && has_value)
+            label = argv[++i];
+        else if (a == "--only" && has_value)
+            only = argv[++i];
+        else if (a == "--threads" && has_value)
+            threads = std::max(1, atoi(argv[++i]));
+        else if (a.size() > 1 && a[0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else
+            files.push_back(a);
+    }
+
+    std::vector<corpus (*)(double)> makers = {
+        make_twitter, make_canada, make_deep, make_long_strings,
+        make_small_docs};
+    std::vector<result> results;
+    try {
+        std::vector<corpus> corpora;
+        if (files.empty()) {
+            for (auto make : makers) {
+                corpus c = make(scale);
+                if (only.empty() || c.name == only)
+                    corpora.push_back(std::move(c));
+            }
+        }
+        for (const std::string &f : files)
+            corpora.push_back(load_file(f));
+
+        printf("%-14s %-13s %10s %8s %12s %12s\n", "corpus", "phase",
+               "bytes", "docs", "MB/s", "docs/s");
+        for (const corpus &c : corpora) {
+            size_t first = results.size();
+            run(c, warmup, reps, threads, results);
+            for (size_t i = first; i < results.size(); ++i) {
+                const result &r = results[i];
+                double m = median(r.seconds);
+                printf("%-14s %-13s %10zu %8zu %12.1f %12.0f\n",
+                       r.corpus.c_str(), r.phase.c_str(), r.bytes, r.docs,
+                       r.bytes / m / 1e6, r.docs / m);
+            }
+        }
+    } catch (std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    if (!json_path.empty()) {
+        std::string out;
+        write_json(results, warmup, reps, threads, scale, label, out);
+        if (json_path == "-") {
+            fwrite(out.data(), 1, out.size(), stdout);
+        } else {
+            std::ofstream f(json_path, std::ios::binary);
+            if (!(f << out)) {
+                fprintf(stderr, "bad file\n");
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -1,14 +1,155 @@
 #ifndef ECL_SLOWJSON_HPP
 #define ECL_SLOWJSON_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <stack>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SLOWJSON_HAS_MMAP 1
+#endif
+
+#ifdef SLOWJSON_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef SLOWJSON_ZSTD
+#include <zstd.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define SLOWJSON_HAS_X86_SIMD 1
+#endif
+
+// Define SLOWJSON_STATS before including this header to have json_storage
+// count what its reads and parses do (see parse_stats). Without it nothing
+// is counted or timed.
+
+// SLOWJSON_BIND(Type, member...) binds the listed members of Type, under
+// their own names, for struct_decoder and encode(). Use it at global scope,
+// with the qualified name of the type. For other keys, specialize
+// ecl::json_binding by hand with bind_field("key", &Type::member).
+#define SLOWJSON_BIND(Type, ...)                                               \
+    template <> struct ecl::json_binding<Type> {                               \
+        static constexpr auto                                                  \
+        fields() {                                                             \
+            return std::make_tuple(SLOWJSON_BIND_FIELDS(Type, __VA_ARGS__));   \
+        }                                                                      \
+    };
+
+#define SLOWJSON_BIND_FIELD(T, f) ::ecl::bind_field(#f, &T::f)
+#define SLOWJSON_BIND_CAT_(a, b) a##b
+#define SLOWJSON_BIND_CAT(a, b) SLOWJSON_BIND_CAT_(a, b)
+#define SLOWJSON_BIND_COUNT_(                                                  \
+    _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16,     \
+    _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30,      \
+    _31, _32, N, ...) N
+#define SLOWJSON_BIND_COUNT(...)                                               \
+    SLOWJSON_BIND_COUNT_(__VA_ARGS__,                                          \
+                         32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20,   \
+                         19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6,   \
+                         5, 4, 3, 2, 1)
+#define SLOWJSON_BIND_FIELDS(T, ...)                                           \
+    SLOWJSON_BIND_CAT(SLOWJSON_BIND_F, SLOWJSON_BIND_COUNT(__VA_ARGS__))       \
+    (T, __VA_ARGS__)
+#define SLOWJSON_BIND_F1(T, f) SLOWJSON_BIND_FIELD(T, f)
+#define SLOWJSON_BIND_F2(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F1(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F3(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F2(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F4(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F3(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F5(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F4(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F6(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F5(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F7(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F6(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F8(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F7(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F9(T, f, ...)                                            \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F8(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F10(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F9(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F11(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F10(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F12(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F11(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F13(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F12(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F14(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F13(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F15(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F14(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F16(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F15(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F17(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F16(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F18(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F17(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F19(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F18(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F20(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F19(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F21(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F20(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F22(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F21(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F23(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F22(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F24(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F23(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F25(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F24(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F26(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F25(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F27(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F26(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F28(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F27(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F29(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F28(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F30(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F29(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F31(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F30(T, __VA_ARGS__)
+#define SLOWJSON_BIND_F32(T, f, ...)                                           \
+    SLOWJSON_BIND_FIELD(T, f), SLOWJSON_BIND_F31(T, __VA_ARGS__)
+
 /**
  * @brief Tokenize -> Analysis -> Generate Json object
  */
@@ -50,112 +191,739 @@ enum valuetype {
     TOKENIZE_TRUE_2_WAIT = 32,
     TOKENIZE_TRUE_3_WAIT = 33,
     TOKENIZE_TRUE_4_WAIT = 34,
+    TOKENIZE_NULL_2_WAIT = 35,
+    TOKENIZE_NULL_3_WAIT = 36,
+    TOKENIZE_NULL_4_WAIT = 37,
+    TOKENIZE_STRING_ESCAPE_WAIT = 38,
+    TOKENIZE_STRING_UNICODE_WAIT = 39,
+    TOKENIZE_NUMBER_MINUS_WAIT = 40,     // -
+    TOKENIZE_NUMBER_ZERO_WAIT = 41,      // 0 or -0
+    TOKENIZE_NUMBER_DOT_WAIT = 42,       // 1.
+    TOKENIZE_NUMBER_FRACTION_WAIT = 43,  // 1.5
+    TOKENIZE_NUMBER_EXP_WAIT = 44,       // 1e
+    TOKENIZE_NUMBER_EXP_SIGN_WAIT = 45,  // 1e-
+    TOKENIZE_NUMBER_EXP_DIGIT_WAIT = 46, // 1e-5
+};
+
+// What parse() does with an integer that does not fit int64_t.
+enum integer_overflow {
+    OVERFLOW_UNSIGNED_OR_FLOAT = 0, // uint64_t if it fits, else nearest double
+    OVERFLOW_FLOAT = 1,             // nearest double
+    OVERFLOW_THROW = 2,
+};
+
+struct jsonobj;
+class key_pool;
+
+// A member name as looked up in a key_pool. id is the name's handle in
+// pool, 0 when the document has no pool, or absent when the name was not
+// in the pool at the time of the lookup. Ids are only compared against
+// nodes interned in the same pool; otherwise the name is.
+struct interned_key {
+    static constexpr uint32_t absent = UINT32_MAX;
+
+    const key_pool *pool;
+    uint32_t id;
+    std::string_view name;
+};
+
+// Open-addressing table over the members of a large object, allocated from
+// the same arena as the nodes. Empty slots are nullptr; a duplicate name
+// keeps its first member.
+struct member_index {
+    size_t mask; // Capacity - 1, capacity being a power of two
+    const jsonobj **slots;
+
+    const jsonobj *
+    find(std::string_view key) const;
 };
 
+// A number that a parse with lazy numbers (see
+// json_storage::set_lazy_numbers()) kept as its text, to be converted on
+// the first read and cached. The node's type says INTEGER or FLOAT, with
+// integers out of int64_t range already sorted by the overflow policy;
+// is_unsigned marks an INTEGER above INT64_MAX. Threads may read the same
+// number: the first of them to finish converting it fills the cache, and
+// state publishes it to the others.
+struct lazy_number {
+    enum : uint8_t { unconverted, converting, converted };
+
+    union number {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+
+    std::string_view text;
+    bool is_unsigned;
+    mutable std::atomic<uint8_t> state;
+    mutable number value; // Written once, before state becomes converted
+
+    // The text of a FLOAT, exactly rounded.
+    static double
+    to_double(std::string_view text) {
+        double d;
+        std::from_chars_result r =
+            std::from_chars(text.data(), text.data() + text.size(), d);
+        // Beyond what a double holds: infinity or zero, by the power of ten
+        // of the number.
+        if (r.ec == std::errc::result_out_of_range) {
+            d = magnitude(text) > 0 ? std::numeric_limits<double>::infinity()
+                                    : 0.0;
+            if (text[0] == '-')
+                d = -d;
+        }
+        return d;
+    }
+
+    // The power of ten of the first nonzero digit of a valid json number,
+    // kept within +-2^40 however long its digits or exponent.
+    static int64_t
+    magnitude(std::string_view text) {
+        const int64_t limit = int64_t(1) << 40;
+        size_t i = text[0] == '-';
+        int64_t power = -1; // Of the digit at i
+        bool point = false;
+        bool lead = false;
+        for (; i < text.size() && text[i] != 'e' && text[i] != 'E'; ++i) {
+            if (text[i] == '.') {
+                point = true;
+            } else if (lead || text[i] != '0') {
+                lead = true;
+                if (!point && power < limit)
+                    ++power;
+            } else if (point) {
+                --power;
+                if (power < -limit)
+                    power = -limit;
+            }
+        }
+        int64_t exponent = 0;
+        if (i < text.size()) {
+            bool negative = text[++i] == '-';
+            if (text[i] == '-' || text[i] == '+')
+                ++i;
+            for (; i < text.size() && exponent < limit; ++i)
+                exponent = exponent * 10 + (text[i] - '0');
+            if (negative)
+                exponent = -exponent;
+        }
+        return power + exponent;
+    }
+
+    // The value of the number, from the cache once it is filled. Threads
+    // converting at the same time each use their own result, and only the
+    // one that claims the cache writes it.
+    number
+    convert(valuetype type) const {
+        if (state.load(std::memory_order_acquire) == converted)
+            return value;
+        number v;
+        const char *first = text.data();
+        const char *last = first + text.size();
+        if (type == FLOAT)
+            v.d = to_double(text);
+        else if (is_unsigned)
+            std::from_chars(first, last, v.u);
+        else
+            std::from_chars(first, last, v.i);
+        uint8_t expected = unconverted;
+        if (state.compare_exchange_strong(expected, converting,
+                                          std::memory_order_relaxed)) {
+            value = v;
+            state.store(converted, std::memory_order_release);
+        }
+        return v;
+    }
+};
+
+// Strings of a node are views into the material, or into the arena when
+// they had to be unescaped, so a node owns nothing and a whole tree can be
+// dropped without running destructors.
 struct jsonobj {
     jsonobj *next;  // Same-level json node
     jsonobj *child; // Next-level json node
     valuetype type;
-    std::string name;
-    std::variant<int64_t, bool, double, std::string> obj;
-    jsonobj() : next(nullptr), child(nullptr), type(JSONNULL) {}
+    uint32_t key; // Id of name in the key_pool of the document, or 0
+    std::string_view name;
+    // INTEGER holds int64_t, or uint64_t above INT64_MAX, and a number of
+    // a parse with lazy numbers its lazy_number. An OBJECT (or TOP) with
+    // enough members holds the index over them.
+    typedef std::variant<int64_t, bool, double, std::string_view, uint64_t,
+                         const member_index *, const lazy_number *>
+        value_holder;
+    value_holder obj;
+    jsonobj() : next(nullptr), child(nullptr), type(JSONNULL), key(0) {}
+
+    // Walks the members of an object or the elements of an array.
+    class iterator {
+    private:
+        const jsonobj *n;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = jsonobj;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const jsonobj *;
+        using reference = const jsonobj &;
+
+        explicit iterator(const jsonobj *p = nullptr) : n(p) {}
+
+        reference operator*() const { return *n; }
+        pointer operator->() const { return n; }
+
+        iterator &
+        operator++() {
+            n = n->next;
+            return *this;
+        }
+
+        iterator
+        operator++(int) {
+            iterator old = *this;
+            n = n->next;
+            return old;
+        }
+
+        bool operator==(const iterator &o) const { return n == o.n; }
+        bool operator!=(const iterator &o) const { return n != o.n; }
+    };
+
+    iterator
+    begin() const {
+        return iterator(child);
+    }
+
+    iterator
+    end() const {
+        return iterator();
+    }
+
+    size_t
+    size() const {
+        size_t n = 0;
+        for (const jsonobj *c = child; c; c = c->next)
+            ++n;
+        return n;
+    }
+
+    // The member named key, or nullptr.
+    const jsonobj *
+    find(std::string_view key) const {
+        if (auto index = std::get_if<const member_index *>(&obj))
+            return (*index)->find(key);
+        for (const jsonobj *c = child; c; c = c->next) {
+            if (c->name == key)
+                return c;
+        }
+        return nullptr;
+    }
+
+    // The same with an interned name, comparing ids instead of strings
+    // when the members were interned in the pool of key.
+    const jsonobj *
+    find(interned_key key) const;
+
+    const jsonobj &
+    operator[](std::string_view key) const {
+        const jsonobj *c = find(key);
+        if (!c)
+            throw std::out_of_range("No such key.\n");
+        return *c;
+    }
+
+    const jsonobj &
+    operator[](interned_key key) const {
+        const jsonobj *c = find(key);
+        if (!c)
+            throw std::out_of_range("No such key.\n");
+        return *c;
+    }
+
+    // The index-th member or element, walking from the first one.
+    const jsonobj &
+    at(size_t index) const {
+        const jsonobj *c = child;
+        for (; c && index; --index)
+            c = c->next;
+        if (!c)
+            throw std::out_of_range("No such index.\n");
+        return *c;
+    }
+
+    // obj, with a lazy number converted to what an eager parse stores.
+    value_holder
+    number() const {
+        auto n = std::get_if<const lazy_number *>(&obj);
+        if (!n)
+            return obj;
+        lazy_number::number v = (*n)->convert(type);
+        if (type == FLOAT)
+            return v.d;
+        if ((*n)->is_unsigned)
+            return v.u;
+        return v.i;
+    }
+
+    // The text of a number as written in the document, when it was parsed
+    // with lazy numbers: exact for integers and decimals of any length.
+    std::string_view
+    number_text() const {
+        if (auto n = std::get_if<const lazy_number *>(&obj))
+            return (*n)->text;
+        throw std::runtime_error("Bad type.\n");
+    }
+
+    // The value as T, one of int64_t, uint64_t, double, bool,
+    // std::string_view and std::string. Integers convert to double, and
+    // between int64_t and uint64_t when the value fits.
+    template <typename T>
+    T
+    get() const {
+        if constexpr (std::is_same_v<T, int64_t>) {
+            if (type == INTEGER) {
+                value_holder v = number();
+                if (auto i = std::get_if<int64_t>(&v))
+                    return *i;
+            }
+        } else if constexpr (std::is_same_v<T, uint64_t>) {
+            if (type == INTEGER) {
+                value_holder v = number();
+                if (auto u = std::get_if<uint64_t>(&v))
+                    return *u;
+                if (std::get<int64_t>(v) >= 0)
+                    return static_cast<uint64_t>(std::get<int64_t>(v));
+            }
+        } else if constexpr (std::is_same_v<T, double>) {
+            if (type == FLOAT)
+                return std::get<double>(number());
+            if (type == INTEGER) {
+                value_holder v = number();
+                if (auto u = std::get_if<uint64_t>(&v))
+                    return static_cast<double>(*u);
+                return static_cast<double>(std::get<int64_t>(v));
+            }
+        } else if constexpr (std::is_same_v<T, bool>) {
+            if (type == BOOLEAN)
+                return std::get<bool>(obj);
+        } else if constexpr (std::is_same_v<T, std::string_view> ||
+                             std::is_same_v<T, std::string>) {
+            if (type == STRING)
+                return T(std::get<std::string_view>(obj));
+        } else {
+            static_assert(!std::is_same_v<T, T>, "Unsupported type.");
+        }
+        throw std::runtime_error("Bad type.\n");
+    }
+
+    // Replay this value and everything below it as parsing events into a
+    // handler (see sax_handler), e.g. a json_writer. Returns false if the
+    // handler stopped.
+    template <typename Handler>
+    bool
+    walk(Handler &h) const {
+        std::vector<const jsonobj *> parents;
+        const jsonobj *n = this;
+        for (;;) {
+            if (!parents.empty() && parents.back()->type != ARRAY &&
+                !h.key(n->name))
+                return false;
+            bool go = true;
+            bool container = false;
+            switch (n->type) {
+            case TOP:
+            case OBJECT: {
+                go = h.start_object();
+                container = true;
+            } break;
+            case ARRAY: {
+                go = h.start_array();
+                container = true;
+            } break;
+            case STRING: {
+                go = h.string(std::get<std::string_view>(n->obj));
+            } break;
+            case INTEGER: {
+                value_holder v = n->number();
+                if (auto u = std::get_if<uint64_t>(&v))
+                    go = h.uint64(*u);
+                else
+                    go = h.int64(std::get<int64_t>(v));
+            } break;
+            case FLOAT: {
+                go = h.float64(std::get<double>(n->number()));
+            } break;
+            case BOOLEAN: {
+                go = h.boolean(std::get<bool>(n->obj));
+            } break;
+            default: {
+                go = h.null();
+            } break;
+            }
+            if (!go)
+                return false;
+            if (container && n->child) {
+                parents.push_back(n);
+                n = n->child;
+                continue;
+            }
+            if (container &&
+                !(n->type == ARRAY ? h.end_array() : h.end_object()))
+                return false;
+            // On to the next sibling, closing the parents that are done.
+            for (;;) {
+                if (parents.empty())
+                    return true;
+                if (n->next) {
+                    n = n->next;
+                    break;
+                }
+                n = parents.back();
+                parents.pop_back();
+                if (!(n->type == ARRAY ? h.end_array() : h.end_object()))
+                    return false;
+            }
+        }
+    }
 };
 
+inline const jsonobj *
+member_index::find(std::string_view key) const {
+    for (size_t i = std::hash<std::string_view>()(key) & mask; slots[i];
+         i = (i + 1) & mask) {
+        if (slots[i]->name == key)
+            return slots[i];
+    }
+    return nullptr;
+}
+
 /**
- * @brief Token definition.
- * No need to generate jsonobj here.
+ * @brief Bump allocator backing the nodes of one parsed document.
+ * Memory is taken from upstream in growing chunks and is only given back
+ * as a whole by release(), so a tree is freed without visiting its nodes.
+ * Supplying a long-lived upstream (e.g. std::pmr::unsynchronized_pool_resource)
+ * lets chunks be recycled across documents.
  */
-class Token {
-public:
-    valuetype token_type;
-    std::string token_value;
+class arena : public std::pmr::memory_resource {
+private:
+    struct chunk {
+        chunk *prev;
+        size_t size;
+    };
+
+    std::pmr::memory_resource *upstream;
+    chunk *head;
+    chunk *spare; // Kept by reset(), for the next allocations
+    char *cur;
+    char *end;
+    size_t next_size;
+    size_t chunks;      // Taken from upstream since construction
+    size_t chunk_bytes; // Their total size
 
 public:
-    Token(std::string v, valuetype t) {
-        token_type = t;
-        token_value = v;
+    static constexpr size_t initial_chunk_size = 4096;
+    static constexpr size_t max_chunk_size = 1 << 20;
+
+    explicit arena(
+        std::pmr::memory_resource *up = std::pmr::get_default_resource())
+        : upstream(up), head(nullptr), spare(nullptr), cur(nullptr),
+          end(nullptr), next_size(initial_chunk_size), chunks(0),
+          chunk_bytes(0) {}
+
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+
+    ~arena() { release(); }
+
+    // Give every chunk back to upstream.
+    void
+    release() {
+        reset();
+        while (spare) {
+            chunk *prev = spare->prev;
+            upstream->deallocate(spare, spare->size,
+                                 alignof(std::max_align_t));
+            spare = prev;
+        }
+        next_size = initial_chunk_size;
     }
-};
 
-class json_storage {
-private:
-    jsonobj parsed_obj;
+    // Free everything allocated so far but keep the chunks, oldest first,
+    // for the next allocations: an arena filled to the same size again does
+    // not go to upstream.
+    void
+    reset() {
+        while (head) {
+            chunk *prev = head->prev;
+            head->prev = spare;
+            spare = head;
+            head = prev;
+        }
+        cur = end = nullptr;
+    }
 
-    std::string json_material;
+    std::pmr::memory_resource *
+    upstream_resource() const {
+        return upstream;
+    }
 
-    std::vector<Token> token_stream;
+    // Chunks requested from upstream so far, and their bytes, counting
+    // those already released.
+    size_t
+    allocations() const {
+        return chunks;
+    }
 
-public:
-    json_storage() {
-        parsed_obj.child = nullptr;
-        parsed_obj.next = nullptr;
+    size_t
+    allocated_bytes() const {
+        return chunk_bytes;
+    }
+
+protected:
+    void *
+    do_allocate(size_t bytes, size_t alignment) override {
+        void *p = cur;
+        size_t space = end - cur;
+        if (!std::align(alignment, bytes, p, space)) {
+            grow(bytes + alignment);
+            p = cur;
+            space = end - cur;
+            std::align(alignment, bytes, p, space);
+        }
+        cur = static_cast<char *>(p) + bytes;
+        return p;
     }
 
+    // Nodes are never freed one by one.
     void
-    read(std::string material) {
-        json_material.clear();
-        json_material = material;
+    do_deallocate(void *, size_t, size_t) override {}
+
+    bool
+    do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
     }
 
+private:
     void
-    read(std::fstream &material) {
-        if (!material.is_open())
-            throw std::runtime_error("bad fstream");
-        material.seekg(std::ios::beg);
-        json_material.clear();
-        char tmp;
-        while (1) {
-            material.get(tmp);
-            if (material.eof())
-                break;
-            json_material = json_material + tmp;
+    grow(size_t need) {
+        for (chunk **s = &spare; *s; s = &(*s)->prev) {
+            chunk *c = *s;
+            if (c->size < need + sizeof(chunk))
+                continue;
+            *s = c->prev;
+            use(c);
+            return;
         }
+        size_t size = next_size;
+        while (size < need + sizeof(chunk))
+            size *= 2;
+        chunk *c = static_cast<chunk *>(
+            upstream->allocate(size, alignof(std::max_align_t)));
+        c->size = size;
+        ++chunks;
+        chunk_bytes += size;
+        use(c);
+        if (next_size < max_chunk_size)
+            next_size *= 2;
     }
 
     void
-    read_token_stream() {
-        for (auto &v : token_stream) {
-            switch (v.token_type) {
-            case LBRACE:
-                std::cout << "LBRACE";
-                break;
-            case RBRACE:
-                std::cout << "RBRACE";
-                break;
-            case LBRACKET:
-                std::cout << "LBRACKET";
-                break;
-            case RBRACKET:
-                std::cout << "RBRACKET";
-                break;
-            case COMMA:
-                std::cout << "COMMA";
-                break;
-            case COLON:
-                std::cout << "COLON";
-                break;
-            case FLOAT:
-                std::cout << "FLOAT";
-                break;
-            case INTEGER:
-                std::cout << "INTEGER";
-                break;
-            case STRING:
-                std::cout << "STRING";
-                break;
-            case BOOLEAN:
-                std::cout << "BOOLEAN";
-                break;
-            default:
-                throw std::runtime_error("Unexpected token tokenized.\n");
-            }
-            std::cout << ' ';
+    use(chunk *c) {
+        c->prev = head;
+        head = c;
+        cur = reinterpret_cast<char *>(c + 1);
+        end = reinterpret_cast<char *>(c) + c->size;
+    }
+};
+
+/**
+ * @brief Interning table for member names.
+ * Each distinct name is copied once into the pool's own arena and numbered
+ * from 1, so documents of the same shape share their names, and nodes
+ * parsed with the pool compare names by id. A pool may be shared by the
+ * storages of several documents as long as only one of them parses at a
+ * time; ids and views stay valid until the pool is cleared or destroyed.
+ */
+class key_pool {
+private:
+    struct slot {
+        uint32_t id; // 0 for an empty slot
+        uint32_t hash;
+    };
+
+    arena bytes;
+    std::vector<std::string_view> names; // names[id - 1]
+    std::vector<slot> slots;             // At most half full
+    std::hash<std::string_view> hasher;
+
+    size_t
+    probe(std::string_view name, uint32_t h) const {
+        size_t mask = slots.size() - 1;
+        size_t i = h & mask;
+        while (slots[i].id &&
+               (slots[i].hash != h || names[slots[i].id - 1] != name))
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void
+    rehash() {
+        std::vector<slot> old(slots.size() ? slots.size() * 2 : 64);
+        old.swap(slots);
+        for (const slot &o : old) {
+            if (o.id)
+                slots[probe(names[o.id - 1], o.hash)] = o;
         }
     }
 
-    // tokenize text. First step of processing raw json text.
+public:
+    explicit key_pool(
+        std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+        : bytes(upstream) {}
+
+    key_pool(const key_pool &) = delete;
+    key_pool &operator=(const key_pool &) = delete;
+
+    // The id of name, adding it if it is new.
+    uint32_t
+    intern(std::string_view name) {
+        if (slots.empty())
+            rehash();
+        uint32_t h = static_cast<uint32_t>(hasher(name));
+        size_t i = probe(name, h);
+        if (slots[i].id)
+            return slots[i].id;
+        if (names.size() == interned_key::absent - 1)
+            throw std::runtime_error("Bad Json: Too many keys.\n");
+        char *copy = static_cast<char *>(bytes.allocate(name.size(), 1));
+        if (!name.empty())
+            memcpy(copy, name.data(), name.size());
+        names.emplace_back(copy, name.size());
+        slots[i] = slot{static_cast<uint32_t>(names.size()), h};
+        if (2 * names.size() > slots.size())
+            rehash();
+        return static_cast<uint32_t>(names.size());
+    }
+
+    // The id of name, or interned_key::absent if it was never interned.
+    uint32_t
+    find(std::string_view name) const {
+        if (slots.empty())
+            return interned_key::absent;
+        uint32_t h = static_cast<uint32_t>(hasher(name));
+        uint32_t id = slots[probe(name, h)].id;
+        return id ? id : interned_key::absent;
+    }
+
+    // The pooled copy of the name numbered id.
+    std::string_view
+    name(uint32_t id) const {
+        return names[id - 1];
+    }
+
+    // Whether name is the pooled copy numbered id, i.e. whether a node of
+    // that key and name was interned in this pool.
+    bool
+    holds(uint32_t id, std::string_view name) const {
+        return id && id <= names.size() &&
+               names[id - 1].data() == name.data();
+    }
+
+    // Number of distinct names.
+    size_t
+    size() const {
+        return names.size();
+    }
+
+    // Forget every name. Trees parsed with the pool must be dropped first.
     void
-    tokenize() {
+    clear() {
+        names.clear();
+        slots.clear();
+        bytes.release();
+    }
+};
+
+inline const jsonobj *
+jsonobj::find(interned_key key) const {
+    // The members of a node are all interned in the same pool, or none is,
+    // so the first one tells whether ids can be compared.
+    if (key.id == 0 || key.id == interned_key::absent || !child ||
+        std::holds_alternative<const member_index *>(obj) ||
+        !key.pool->holds(child->key, child->name))
+        return find(key.name);
+    for (const jsonobj *c = child; c; c = c->next) {
+        if (c->key == key.id)
+            return c;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Token definition.
+ * No need to generate jsonobj here.
+ */
+class Token {
+public:
+    valuetype token_type;
+    std::string_view token_value; // Points into the material, or into the
+                                  // storage of unescaped strings.
+
+public:
+    Token(std::string_view v, valuetype t) {
+        token_type = t;
+        token_value = v;
+    }
+};
+
+/**
+ * @brief Resumable tokenizer.
+ * Holds the status machine of tokenizing, so that tokens can be handed
+ * to a consumer one by one instead of being collected into token_stream.
+ * emit(valuetype, std::string_view) is called for every token; the view
+ * is only valid during the call. Returning false from emit stops scanning.
+ *
+ * Strings without escapes and numbers are emitted as views into the scanned
+ * buffer. Only unescaped strings, and tokens cut by the end of a buffer, are
+ * collected into string_tmp / number_tmp.
+ */
+class tokenizer {
+    friend class json_validator;
+
+public:
+    valuetype machine_status = TOKENIZE_IDLE;
+    std::string number_tmp;
+    valuetype number_type_tmp = INTEGER;
+    std::string string_tmp;
+
+    // Start of the current string or number in the buffer being scanned,
+    // nullptr once its bytes have been moved into string_tmp / number_tmp.
+    const char *token_begin = nullptr;
+
+    // \uXXXX decoding.
+    uint32_t unicode_value = 0;
+    int unicode_digits = 0;
+    uint32_t high_surrogate = 0;
+
+public:
+    // Back to the start of a text, keeping the capacity of the buffers.
+    void
+    reset() {
+        machine_status = TOKENIZE_IDLE;
+        number_tmp.clear();
+        number_type_tmp = INTEGER;
+        string_tmp.clear();
+        token_begin = nullptr;
+        unicode_value = 0;
+        unicode_digits = 0;
+        high_surrogate = 0;
+    }
+
+    // Feed [first, last) into the machine. Returns false if emit asked to
+    // stop.
+    template <typename Emit>
+    bool
+    scan(const char *first, const char *last, Emit &&emit) {
         // Tokenizing can be represented as status machine.
         // In this machine we mainly focus on these syntaxs:
         //  (a) LBRACE.
@@ -169,39 +937,44 @@ public:
         //  (i) BOOLEAN.
         //  (j) STRING.
         //  (k) JSONNULL.
-        valuetype machine_status = TOKENIZE_IDLE;
-        std::string number_tmp;
-        valuetype number_type_tmp;
-        std::string string_tmp;
-        for (auto &c : json_material) {
+        for (; first != last; ++first) {
+            char c = *first;
             switch (machine_status) {
             case TOKENIZE_IDLE: {
                 switch (c) {
                 case '\t':
                 case '\n':
+                case '\r':
                 case ' ': {
                     continue;
                 } break;
                 case '{': {
-                    token_stream.push_back(Token("{", LBRACE));
+                    if (!emit(LBRACE, "{"))
+                        return false;
                 } break;
                 case '}': {
-                    token_stream.push_back(Token("}", RBRACE));
+                    if (!emit(RBRACE, "}"))
+                        return false;
                 } break;
                 case '[': {
-                    token_stream.push_back(Token("[", LBRACKET));
+                    if (!emit(LBRACKET, "["))
+                        return false;
                 } break;
                 case ']': {
-                    token_stream.push_back(Token("]", RBRACKET));
+                    if (!emit(RBRACKET, "]"))
+                        return false;
                 } break;
                 case ':': {
-                    token_stream.push_back(Token(":", COLON));
+                    if (!emit(COLON, ":"))
+                        return false;
                 } break;
                 case ',': {
-                    token_stream.push_back(Token(",", COMMA));
+                    if (!emit(COMMA, ","))
+                        return false;
                 } break;
                 case '"': {
                     string_tmp.clear();
+                    token_begin = first + 1;
                     machine_status = TOKENIZE_STRING_WAIT;
                 } break;
                 case 'f': {
@@ -210,6 +983,10 @@ public:
                 case 't': {
                     machine_status = TOKENIZE_TRUE_2_WAIT;
                 } break;
+                case 'n': {
+                    machine_status = TOKENIZE_NULL_2_WAIT;
+                } break;
+                case '-':
                 case '0':
                 case '1':
                 case '2':
@@ -221,55 +998,66 @@ public:
                 case '8':
                 case '9': {
                     number_tmp.clear();
-                    number_tmp += c;
-                    // Integer is the init type. When meet '.', transform.
+                    token_begin = first;
+                    // Integer is the init type. When meet '.' or an
+                    // exponent, transform.
                     number_type_tmp = INTEGER;
-                    machine_status = TOKENIZE_NUMBER_WAIT;
+                    machine_status = number_start(c);
                 } break;
+                default:
+                    throw std::runtime_error("Bad Json: Bad tokens.\n");
                 }
             } break;
-            case TOKENIZE_NUMBER_WAIT: {
+            case TOKENIZE_NUMBER_MINUS_WAIT:
+            case TOKENIZE_NUMBER_ZERO_WAIT:
+            case TOKENIZE_NUMBER_WAIT:
+            case TOKENIZE_NUMBER_DOT_WAIT:
+            case TOKENIZE_NUMBER_FRACTION_WAIT:
+            case TOKENIZE_NUMBER_EXP_WAIT:
+            case TOKENIZE_NUMBER_EXP_SIGN_WAIT:
+            case TOKENIZE_NUMBER_EXP_DIGIT_WAIT: {
+                valuetype next = number_step(machine_status, c);
+                if (next != TOKENIZE_IDLE) {
+                    if (!token_begin)
+                        number_tmp += c;
+                    // A fraction or an exponent makes it a float.
+                    if (next >= TOKENIZE_NUMBER_DOT_WAIT)
+                        number_type_tmp = FLOAT;
+                    machine_status = next;
+                    break;
+                }
+                // c is not part of the number: it has to end it.
+                if (!number_complete(machine_status))
+                    throw std::runtime_error("Bad Json: Bad numbers.\n");
                 switch (c) {
-                case '0':
-                case '1':
-                case '2':
-                case '3':
-                case '4':
-                case '5':
-                case '6':
-                case '7':
-                case '8':
-                case '9': {
-                    number_tmp += c;
-                } break;
-                case '.': {
-                    number_tmp += c;
-                    number_type_tmp = FLOAT;
-                } break;
                 case ' ':
                 case '\t':
-                case '\n': {
-                    token_stream.push_back(
-                        Token(number_tmp, number_type_tmp));
+                case '\n':
+                case '\r': {
                     machine_status = TOKENIZE_IDLE;
+                    if (!emit(number_type_tmp, take(first, number_tmp)))
+                        return false;
                 } break;
                 case ',': {
-                    token_stream.push_back(
-                        Token(number_tmp, number_type_tmp));
-                    token_stream.push_back(Token(",", COMMA));
                     machine_status = TOKENIZE_IDLE;
+                    if (!emit(number_type_tmp, take(first, number_tmp)))
+                        return false;
+                    if (!emit(COMMA, ","))
+                        return false;
                 } break;
                 case '}': {
-                    token_stream.push_back(
-                        Token(number_tmp, number_type_tmp));
-                    token_stream.push_back(Token("}", RBRACE));
                     machine_status = TOKENIZE_IDLE;
+                    if (!emit(number_type_tmp, take(first, number_tmp)))
+                        return false;
+                    if (!emit(RBRACE, "}"))
+                        return false;
                 } break;
                 case ']': {
-                    token_stream.push_back(
-                        Token(number_tmp, number_type_tmp));
-                    token_stream.push_back(Token("]", RBRACKET));
                     machine_status = TOKENIZE_IDLE;
+                    if (!emit(number_type_tmp, take(first, number_tmp)))
+                        return false;
+                    if (!emit(RBRACKET, "]"))
+                        return false;
                 } break;
                 default:
                     throw std::runtime_error("Bad Json: Bad numbers.\n");
@@ -277,26 +1065,101 @@ public:
                 break;
             } break;
             case TOKENIZE_STRING_WAIT: {
-                if (c != '"') {
-                    string_tmp += c;
-                } else {
-                    if (string_tmp.length() == 0)
-                        throw std::runtime_error("Bad Json: Bad string.\n");
-                    token_stream.push_back(Token(string_tmp, STRING));
+                // Skip to the next quote or backslash in one go.
+                const char *stop = first;
+                while (stop != last && *stop != '"' && *stop != '\\')
+                    ++stop;
+                // A high surrogate must be followed by another \u escape.
+                if (high_surrogate &&
+                    (stop != first || (stop != last && *stop != '\\')))
+                    throw std::runtime_error("Bad Json: Bad escape.\n");
+                if (!token_begin)
+                    string_tmp.append(first, stop);
+                if (stop == last) {
+                    first = last - 1;
+                    break;
+                }
+                first = stop;
+                if (*first == '"') {
                     machine_status = TOKENIZE_IDLE;
+                    if (!emit(STRING, take(first, string_tmp)))
+                        return false;
+                } else {
+                    // From the first escape on, the string is collected.
+                    if (token_begin) {
+                        string_tmp.assign(token_begin, first);
+                        token_begin = nullptr;
+                    }
+                    machine_status = TOKENIZE_STRING_ESCAPE_WAIT;
                 }
             } break;
-            case TOKENIZE_FALSE_2_WAIT: {
-                if (c != 'a')
-                    throw std::runtime_error("Bad Json: Bad syntax.\n");
-                machine_status = TOKENIZE_FALSE_3_WAIT;
-            } break;
-            case TOKENIZE_FALSE_3_WAIT: {
-                if (c != 'l')
-                    throw std::runtime_error("Bad Json: Bad syntax.\n");
-                machine_status = TOKENIZE_FALSE_4_WAIT;
-            } break;
-            case TOKENIZE_FALSE_4_WAIT: {
+            case TOKENIZE_STRING_ESCAPE_WAIT: {
+                if (high_surrogate && c != 'u')
+                    throw std::runtime_error("Bad Json: Bad escape.\n");
+                machine_status = TOKENIZE_STRING_WAIT;
+                switch (c) {
+                case '"':
+                case '\\':
+                case '/': {
+                    string_tmp += c;
+                } break;
+                case 'b': {
+                    string_tmp += '\b';
+                } break;
+                case 'f': {
+                    string_tmp += '\f';
+                } break;
+                case 'n': {
+                    string_tmp += '\n';
+                } break;
+                case 'r': {
+                    string_tmp += '\r';
+                } break;
+                case 't': {
+                    string_tmp += '\t';
+                } break;
+                case 'u': {
+                    unicode_value = 0;
+                    unicode_digits = 0;
+                    machine_status = TOKENIZE_STRING_UNICODE_WAIT;
+                } break;
+                default:
+                    throw std::runtime_error("Bad Json: Bad escape.\n");
+                }
+            } break;
+            case TOKENIZE_STRING_UNICODE_WAIT: {
+                int digit = hex_digit(c);
+                if (digit < 0)
+                    throw std::runtime_error("Bad Json: Bad escape.\n");
+                unicode_value = unicode_value * 16 + digit;
+                if (++unicode_digits < 4)
+                    break;
+                machine_status = TOKENIZE_STRING_WAIT;
+                if (high_surrogate) {
+                    if (unicode_value < 0xDC00 || unicode_value > 0xDFFF)
+                        throw std::runtime_error("Bad Json: Bad escape.\n");
+                    append_utf8(0x10000 + ((high_surrogate - 0xD800) << 10) +
+                                (unicode_value - 0xDC00));
+                    high_surrogate = 0;
+                } else if (unicode_value >= 0xD800 && unicode_value <= 0xDBFF) {
+                    high_surrogate = unicode_value;
+                } else if (unicode_value >= 0xDC00 && unicode_value <= 0xDFFF) {
+                    throw std::runtime_error("Bad Json: Bad escape.\n");
+                } else {
+                    append_utf8(unicode_value);
+                }
+            } break;
+            case TOKENIZE_FALSE_2_WAIT: {
+                if (c != 'a')
+                    throw std::runtime_error("Bad Json: Bad syntax.\n");
+                machine_status = TOKENIZE_FALSE_3_WAIT;
+            } break;
+            case TOKENIZE_FALSE_3_WAIT: {
+                if (c != 'l')
+                    throw std::runtime_error("Bad Json: Bad syntax.\n");
+                machine_status = TOKENIZE_FALSE_4_WAIT;
+            } break;
+            case TOKENIZE_FALSE_4_WAIT: {
                 if (c != 's')
                     throw std::runtime_error("Bad Json: Bad syntax.\n");
                 machine_status = TOKENIZE_FALSE_5_WAIT;
@@ -305,7 +1168,8 @@ public:
                 if (c != 'e')
                     throw std::runtime_error("Bad Json: Bad syntax.\n");
                 machine_status = TOKENIZE_IDLE;
-                token_stream.push_back(Token("false", BOOLEAN));
+                if (!emit(BOOLEAN, "false"))
+                    return false;
             } break;
             case TOKENIZE_TRUE_2_WAIT: {
                 if (c != 'r')
@@ -321,405 +1185,5872 @@ public:
                 if (c != 'e')
                     throw std::runtime_error("Bad Json: Bad syntax.\n");
                 machine_status = TOKENIZE_IDLE;
-                token_stream.push_back(Token("true", BOOLEAN));
+                if (!emit(BOOLEAN, "true"))
+                    return false;
+            } break;
+            case TOKENIZE_NULL_2_WAIT: {
+                if (c != 'u')
+                    throw std::runtime_error("Bad Json: Bad syntax.\n");
+                machine_status = TOKENIZE_NULL_3_WAIT;
+            } break;
+            case TOKENIZE_NULL_3_WAIT: {
+                if (c != 'l')
+                    throw std::runtime_error("Bad Json: Bad syntax.\n");
+                machine_status = TOKENIZE_NULL_4_WAIT;
+            } break;
+            case TOKENIZE_NULL_4_WAIT: {
+                if (c != 'l')
+                    throw std::runtime_error("Bad Json: Bad syntax.\n");
+                machine_status = TOKENIZE_IDLE;
+                if (!emit(JSONNULL, "null"))
+                    return false;
             } break;
             default:
                 throw std::runtime_error("Bad Json: Bad tokens.\n");
             }
         }
+        // The buffer may not outlive this call, keep the unfinished token.
+        if (token_begin) {
+            if (machine_status == TOKENIZE_STRING_WAIT)
+                string_tmp.append(token_begin, last);
+            else
+                number_tmp.append(token_begin, last);
+            token_begin = nullptr;
+        }
+        return true;
     }
 
-private:
+    // Feed [first, last) using its structural index (see structural_index).
+    // Whitespace between tokens is never looked at; punctuation, strings
+    // without escapes, plain numbers and literals are taken in one step.
+    // Everything else is handed to scan() in chunks that end on an indexed
+    // position, so the tokens (and errors) are exactly the ones scan() alone
+    // would produce.
+    template <typename Emit>
     bool
-    validation_basic() {
-        std::stack<valuetype> check;
-        for (auto &i : token_stream) {
-            if (i.token_type == LBRACE) {
-                check.push(LBRACE);
-            } else if (i.token_type == LBRACKET) {
-                check.push(LBRACKET);
-            } else if (i.token_type == RBRACE) {
-                if (check.top() == LBRACE)
-                    check.pop();
-            } else if (i.token_type == RBRACKET) {
-                if (check.top() == LBRACKET)
-                    check.pop();
+    scan_indexed(const char *first, const char *last,
+                 const std::vector<uint32_t> &index, Emit &&emit) {
+        const char *pos = first;
+        size_t i = 0;
+        size_t n = index.size();
+        while (1) {
+            while (i < n && first + index[i] < pos)
+                ++i;
+            const char *stop = nullptr;
+            if (machine_status != TOKENIZE_IDLE) {
+                stop = chunk_end(first, last, index, i);
+                if (stop <= pos)
+                    stop = chunk_end(first, last, index, i + 1);
+                if (!scan(pos, stop, emit))
+                    return false;
+                pos = stop;
+                if (pos == last)
+                    return true;
+                continue;
+            }
+            // Nothing but whitespace until the next entry.
+            if (i == n)
+                return true;
+            pos = first + index[i];
+            switch (*pos) {
+            case '{': {
+                if (!emit(LBRACE, "{"))
+                    return false;
+                stop = pos + 1;
+            } break;
+            case '}': {
+                if (!emit(RBRACE, "}"))
+                    return false;
+                stop = pos + 1;
+            } break;
+            case '[': {
+                if (!emit(LBRACKET, "["))
+                    return false;
+                stop = pos + 1;
+            } break;
+            case ']': {
+                if (!emit(RBRACKET, "]"))
+                    return false;
+                stop = pos + 1;
+            } break;
+            case ':': {
+                if (!emit(COLON, ":"))
+                    return false;
+                stop = pos + 1;
+            } break;
+            case ',': {
+                if (!emit(COMMA, ","))
+                    return false;
+                stop = pos + 1;
+            } break;
+            case '"': {
+                // An opening quote is always followed by its closing quote
+                // in the index.
+                if (i + 1 == n)
+                    break;
+                const char *close = first + index[i + 1];
+                if (memchr(pos + 1, '\\', close - pos - 1))
+                    break;
+                if (!emit(STRING, std::string_view(pos + 1, close - pos - 1)))
+                    return false;
+                stop = close + 1;
+            } break;
+            case '-':
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+            case '4':
+            case '5':
+            case '6':
+            case '7':
+            case '8':
+            case '9': {
+                // Same steps as the number states of scan().
+                valuetype status = number_start(*pos);
+                valuetype type = INTEGER;
+                const char *q = pos + 1;
+                for (; q != last; ++q) {
+                    valuetype next = number_step(status, *q);
+                    if (next == TOKENIZE_IDLE)
+                        break;
+                    if (next >= TOKENIZE_NUMBER_DOT_WAIT)
+                        type = FLOAT;
+                    status = next;
+                }
+                if (q == last || !number_complete(status))
+                    break;
+                switch (*q) {
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\r': {
+                    if (!emit(type, std::string_view(pos, q - pos)))
+                        return false;
+                    stop = q + 1;
+                } break;
+                case ',': {
+                    if (!emit(type, std::string_view(pos, q - pos)) ||
+                        !emit(COMMA, ","))
+                        return false;
+                    stop = q + 1;
+                } break;
+                case '}': {
+                    if (!emit(type, std::string_view(pos, q - pos)) ||
+                        !emit(RBRACE, "}"))
+                        return false;
+                    stop = q + 1;
+                } break;
+                case ']': {
+                    if (!emit(type, std::string_view(pos, q - pos)) ||
+                        !emit(RBRACKET, "]"))
+                        return false;
+                    stop = q + 1;
+                } break;
+                }
+            } break;
+            case 't':
+            case 'f':
+            case 'n': {
+                // Only a literal standing alone, the machine deals with
+                // whatever is glued to it.
+                std::string_view word = *pos == 't'   ? "true"
+                                        : *pos == 'f' ? "false"
+                                                      : "null";
+                const char *end = pos + word.size();
+                if (end > last || std::string_view(pos, word.size()) != word ||
+                    (end != last && !ends_run(*end)))
+                    break;
+                if (!emit(*pos == 'n' ? JSONNULL : BOOLEAN, word))
+                    return false;
+                stop = end;
+            } break;
+            }
+            if (!stop) {
+                stop = chunk_end(first, last, index, i + 1);
+                if (!scan(pos, stop, emit))
+                    return false;
             }
+            pos = stop;
+            if (pos == last)
+                return true;
         }
-        return !check.empty();
     }
 
-public:
-    // parse stored token_stream, generating parsed_obj.
+    // End of input. A pending number is flushed; any other unfinished
+    // token is an error.
+    template <typename Emit>
+    bool
+    finish(Emit &&emit) {
+        switch (machine_status) {
+        case TOKENIZE_IDLE:
+            return true;
+        case TOKENIZE_NUMBER_MINUS_WAIT:
+        case TOKENIZE_NUMBER_ZERO_WAIT:
+        case TOKENIZE_NUMBER_WAIT:
+        case TOKENIZE_NUMBER_DOT_WAIT:
+        case TOKENIZE_NUMBER_FRACTION_WAIT:
+        case TOKENIZE_NUMBER_EXP_WAIT:
+        case TOKENIZE_NUMBER_EXP_SIGN_WAIT:
+        case TOKENIZE_NUMBER_EXP_DIGIT_WAIT:
+            if (!number_complete(machine_status))
+                throw std::runtime_error("Bad Json: Bad numbers.\n");
+            machine_status = TOKENIZE_IDLE;
+            return emit(number_type_tmp, number_tmp);
+        default:
+            throw std::runtime_error("Bad Json: Unexpected end.\n");
+        }
+    }
+
+private:
+    // Number grammar: -? (0 | [1-9][0-9]*) (. [0-9]+)? ([eE] [+-]? [0-9]+)?
+    // First status of a number starting with c ('-' or a digit).
+    static valuetype
+    number_start(char c) {
+        return c == '-' ? TOKENIZE_NUMBER_MINUS_WAIT
+               : c == '0' ? TOKENIZE_NUMBER_ZERO_WAIT
+                          : TOKENIZE_NUMBER_WAIT;
+    }
+
+    // Next status of a number after c, TOKENIZE_IDLE if c is not part of it.
+    static valuetype
+    number_step(valuetype status, char c) {
+        bool digit = c >= '0' && c <= '9';
+        switch (status) {
+        case TOKENIZE_NUMBER_MINUS_WAIT:
+            return !digit     ? TOKENIZE_IDLE
+                   : c == '0' ? TOKENIZE_NUMBER_ZERO_WAIT
+                              : TOKENIZE_NUMBER_WAIT;
+        case TOKENIZE_NUMBER_ZERO_WAIT:
+        case TOKENIZE_NUMBER_WAIT:
+            if (digit && status == TOKENIZE_NUMBER_WAIT)
+                return TOKENIZE_NUMBER_WAIT;
+            if (c == '.')
+                return TOKENIZE_NUMBER_DOT_WAIT;
+            if (c == 'e' || c == 'E')
+                return TOKENIZE_NUMBER_EXP_WAIT;
+            return TOKENIZE_IDLE;
+        case TOKENIZE_NUMBER_DOT_WAIT:
+            return digit ? TOKENIZE_NUMBER_FRACTION_WAIT : TOKENIZE_IDLE;
+        case TOKENIZE_NUMBER_FRACTION_WAIT:
+            if (digit)
+                return TOKENIZE_NUMBER_FRACTION_WAIT;
+            if (c == 'e' || c == 'E')
+                return TOKENIZE_NUMBER_EXP_WAIT;
+            return TOKENIZE_IDLE;
+        case TOKENIZE_NUMBER_EXP_WAIT:
+            if (c == '+' || c == '-')
+                return TOKENIZE_NUMBER_EXP_SIGN_WAIT;
+            return digit ? TOKENIZE_NUMBER_EXP_DIGIT_WAIT : TOKENIZE_IDLE;
+        case TOKENIZE_NUMBER_EXP_SIGN_WAIT:
+        case TOKENIZE_NUMBER_EXP_DIGIT_WAIT:
+            return digit ? TOKENIZE_NUMBER_EXP_DIGIT_WAIT : TOKENIZE_IDLE;
+        default:
+            return TOKENIZE_IDLE;
+        }
+    }
+
+    // Whether a number may end in this status.
+    static bool
+    number_complete(valuetype status) {
+        return status == TOKENIZE_NUMBER_ZERO_WAIT ||
+               status == TOKENIZE_NUMBER_WAIT ||
+               status == TOKENIZE_NUMBER_FRACTION_WAIT ||
+               status == TOKENIZE_NUMBER_EXP_DIGIT_WAIT;
+    }
+
+    // A chunk handed to scan() by scan_indexed() ends after the structural
+    // character or quote at index[j], or right before the number / literal
+    // starting there, so no part of a token is ever skipped.
+    static const char *
+    chunk_end(const char *first, const char *last,
+              const std::vector<uint32_t> &index, size_t j) {
+        if (j >= index.size())
+            return last;
+        const char *p = first + index[j];
+        switch (*p) {
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+        case '"':
+            return p + 1;
+        default:
+            return p;
+        }
+    }
+
+    // Whether c ends a run of number / literal bytes in the index.
+    static bool
+    ends_run(char c) {
+        switch (c) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+        case '"':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // The current string or number, ending right before pos.
+    std::string_view
+    take(const char *pos, const std::string &tmp) {
+        if (!token_begin)
+            return tmp;
+        std::string_view v(token_begin, pos - token_begin);
+        token_begin = nullptr;
+        return v;
+    }
+
+    static int
+    hex_digit(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
     void
-    parse() {
-        jsonobj *p = &parsed_obj;
-        std::stack<jsonobj *> parse_stack;
-        std::stack<valuetype> machine_status;
+    append_utf8(uint32_t cp) {
+        if (cp < 0x80) {
+            string_tmp += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            string_tmp += static_cast<char>(0xC0 | (cp >> 6));
+            string_tmp += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            string_tmp += static_cast<char>(0xE0 | (cp >> 12));
+            string_tmp += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            string_tmp += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            string_tmp += static_cast<char>(0xF0 | (cp >> 18));
+            string_tmp += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            string_tmp += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            string_tmp += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+};
 
-        std::string name_tmp;
+/**
+ * @brief Structural index of a text, the vectorized first stage of tokenize().
+ * The text is classified 64 bytes at a time into quotes, backslashes,
+ * structural characters and whitespace. Escaped characters and the parts
+ * inside strings are worked out with bit tricks over these masks, and the
+ * positions of every structural character, every quote and the first byte of
+ * every number or literal are collected into positions. Stage two
+ * (tokenizer::scan_indexed) then jumps from position to position.
+ */
+enum simd_level {
+    SIMD_SCALAR = 0,
+    SIMD_SSE42 = 1,
+    SIMD_AVX2 = 2,
+    SIMD_BEST = 3, // Pick the best one the cpu supports
+};
 
-        // parse_stack.push(nullptr);
-        machine_status.push(PARSE_INIT);
+class structural_index {
+public:
+    std::vector<uint32_t> positions;
 
-        for (auto &i : token_stream) {
-            if (machine_status.empty())
-                return;
-            switch (machine_status.top()) {
-            // The init state needs to be dealed with seperately.
-            // Since a lbrace is a forced requirement, we are expecting LBRACE.
-            // After receiving LBRACE, we transform into
-            // PARSE_OBJECT_INIT_CONTENT_WAIT, in case the package has no object.
-            case PARSE_INIT: {
-                if (i.token_type != LBRACE)
-                    throw std::runtime_error("Bad Json: Not starting with '{'.\n");
-                p->child = new jsonobj();
-                p->type = TOP;
+private:
+    struct block_masks {
+        uint64_t quote;
+        uint64_t backslash;
+        uint64_t op; // { } [ ] : ,
+        uint64_t whitespace;
+        uint64_t newline;
+    };
 
-                machine_status.top() = PARSE_OBJECT_INIT_CONTENT_WAIT;
+    typedef void (*classifier)(const char *, block_masks &);
 
-                parse_stack.push(p);
-                p = p->child;
-            } break;
-
-            // When creating a new json object, there might be few cases
-            // expected: (a). the object has content, therefore the machine
-            // transfrom into PARSE_COLON_WAIT. (b). the object has no content,
-            // in the case of getting syntax RBRACE. Pop machine_status Notice
-            // that we will deal with array seperately. For (a) the procedure is
-            // actually the same of PARSE_NAME_WAIT.
-            case PARSE_OBJECT_INIT_CONTENT_WAIT: {
-                switch (i.token_type) {
-                case STRING: {
-                    // Storing the name into name_tmp, waiting for the
-                    // compelete unit to complete.
-                    name_tmp = i.token_value;
-                    // Transforming
-                    machine_status.top() = PARSE_COLON_WAIT;
-                } break;
-                case RBRACE: {
-                    machine_status.pop();
-                    parse_stack.pop();
-                    p = parse_stack.top();
-                    if (parse_stack.empty())
-                        return;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                default:
-                    throw std::runtime_error("Bad Json: Bad expression.\n");
-                }
-            } break;
+public:
+    // Index text. Returns false if the index cannot be used: the text is too
+    // long for 32-bit positions, or a backslash shows up outside of a string
+    // (which is never valid json); the scalar tokenizer must be used then.
+    bool
+    build(std::string_view text, simd_level level = SIMD_BEST) {
+        if (text.size() > UINT32_MAX)
+            return false;
+        // Entries are written in place; positions keeps some slack
+        // (capacity is reused from the previous build).
+        positions.resize(std::max<size_t>(positions.capacity(), 256));
+        if (level == SIMD_BEST || level > best_level())
+            level = best_level();
+        switch (level) {
+#ifdef SLOWJSON_HAS_X86_SIMD
+        case SIMD_AVX2:
+            return build_avx2(text);
+        case SIMD_SSE42:
+            return build_sse42(text);
+#endif
+        default:
+            return build_blocks<classify_scalar>(text);
+        }
+    }
 
-            // Since the array will be dealed with seperately, here we expect
-            // these syntaxs: (a) STRING Then we will transform into
-            // PARSE_COLON_WAIT.
-            case PARSE_NAME_WAIT: {
-                if (i.token_type != STRING)
-                    throw std::runtime_error("Bad Json: Bad syntax.\n");
-                // Storing the name into name_tmp, waiting for the compelete unit
-                // to complete.
-                name_tmp = i.token_value;
-                // Transforming
-                machine_status.top() = PARSE_COLON_WAIT;
-            } break;
+    // Cut newline-delimited json into records at the newlines outside of
+    // strings, leaving out blank lines. Works for any text length.
+    static void
+    split_records(std::string_view text, std::vector<std::string_view> &records,
+                  simd_level level = SIMD_BEST) {
+        records.clear();
+        if (level == SIMD_BEST || level > best_level())
+            level = best_level();
+        switch (level) {
+#ifdef SLOWJSON_HAS_X86_SIMD
+        case SIMD_AVX2:
+            return split_avx2(text, records);
+        case SIMD_SSE42:
+            return split_sse42(text, records);
+#endif
+        default:
+            return split_blocks<classify_scalar>(text, records);
+        }
+    }
 
-            // This is the most complicated part of the design. We are expecting:
-            // (a) LBRACE. This means that a new object will be constructed.
-            //     We need to transform into PARSE_COMMA_WAIT,
-            //     and push a PARSE_OBJECT_INIT_CONTENT_WAIT.
-            // (b) LBRACKET. This means that a new array will be constructed. We
-            // need to transform
-            //     into PARSE_COMMA_WAIT, and push a PARSING_ARRAY_INIT.
-            // (c) FLOAT. This is part of the value. We need to make a new
-            // jsonobj, put name_tmp and
-            //     casted i.token_value(double) into std::variant, transform into
-            //     PARSE_COMMA_WAIT.
-            // (c) INTEGER. This is part of the value. We need to make a new
-            // jsonobj, put name_tmp and
-            //     casted i.token_value(int64_t) into std::variant, transform
-            //     into PARSE_COMMA_WAIT.
-            // (c) STRING. This is part of the value. We need to make a new
-            // jsonobj, put name_tmp and
-            //     i.token_value into std::variant, transform into
-            //     PARSE_COMMA_WAIT.
-            // (c) BOOLEAN. This is part of the value. We need to make a new
-            // jsonobj, put name_tmp and
-            //     casted i.token_value(bool) into std::variant, transform into
-            //     PARSE_COMMA_WAIT.
-            case PARSE_VALUE_WAIT: {
-                switch (i.token_type) {
-                case LBRACE: {
-                    machine_status.top() = PARSE_COMMA_WAIT;
-                    machine_status.push(PARSE_OBJECT_INIT_CONTENT_WAIT);
-                    parse_stack.push(p);
-                    p->name = name_tmp;
-                    p->type = OBJECT;
-                    p->child = new jsonobj();
-                    p = p->child;
-                } break;
-                case LBRACKET: {
-                    machine_status.top() = PARSE_COMMA_WAIT;
-                    machine_status.push(PARSE_ARRAY_INIT_CONTENT_WAIT);
-                    p->name = name_tmp;
-                    p->type = ARRAY;
-                    p->child = new jsonobj();
-                    parse_stack.push(p);
-                    p = p->child;
-                } break;
-                case FLOAT: {
-                    machine_status.top() = PARSE_COMMA_WAIT;
-                    p->name = name_tmp;
-                    p->type = FLOAT;
-                    p->obj = atof(i.token_value.c_str());
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case INTEGER: {
-                    machine_status.top() = PARSE_COMMA_WAIT;
-                    p->name = name_tmp;
-                    p->type = INTEGER;
-                    p->obj = atoll(i.token_value.c_str());
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case STRING: {
-                    machine_status.top() = PARSE_COMMA_WAIT;
-                    p->name = name_tmp;
-                    p->type = STRING;
-                    p->obj = i.token_value;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case BOOLEAN: {
-                    machine_status.top() = PARSE_COMMA_WAIT;
-                    p->name = name_tmp;
-                    p->type = BOOLEAN;
-                    if (i.token_value == "true")
-                        p->obj = true;
-                    else if (i.token_value == "false")
-                        p->obj = false;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                default:
-                    throw std::runtime_error("Bad Json: Illegal value.\n");
-                }
-            } break;
+    // Visit the structural characters ({ } [ ] : ,) of a piece of text in
+    // order as visit(offset, in_string), in_string telling whether the
+    // character is inside a string if the piece starts outside of one;
+    // visit returns false to stop. Returns whether the piece ends inside a
+    // string, under the same assumption. The piece must not start right
+    // after a backslash.
+    template <typename Visit>
+    static bool
+    visit_ops(std::string_view text, Visit &&visit) {
+        switch (best_level()) {
+#ifdef SLOWJSON_HAS_X86_SIMD
+        case SIMD_AVX2:
+            return ops_avx2(text, visit);
+        case SIMD_SSE42:
+            return ops_sse42(text, visit);
+#endif
+        default:
+            return ops_blocks<classify_scalar>(text, visit);
+        }
+    }
 
-            // Since the array will be dealed with seperately, we are simply
-            // expecting these syntaxs: (a) COMMA. This means that the package is
-            // not done, transform into PARSE_NAME_WAIT for next item. (b)
-            // RBRACE. This means that the package is done, Pop machine_status.
-            case PARSE_COMMA_WAIT: {
-                switch (i.token_type) {
-                case COMMA: {
-                    machine_status.top() = PARSE_NAME_WAIT;
-                } break;
-                case RBRACE: {
-                    machine_status.pop();
-                    p = parse_stack.top();
-                    parse_stack.pop();
-                    if (parse_stack.empty())
-                        return;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                default:
-                    throw std::runtime_error("Bad Json: Bad syntax.\n");
-                }
-            } break;
+    static simd_level
+    best_level() {
+#ifdef SLOWJSON_HAS_X86_SIMD
+        static const simd_level level = __builtin_cpu_supports("avx2")
+                                            ? SIMD_AVX2
+                                            : __builtin_cpu_supports("sse4.2")
+                                                  ? SIMD_SSE42
+                                                  : SIMD_SCALAR;
+        return level;
+#else
+        return SIMD_SCALAR;
+#endif
+    }
 
-            // Since the array will be dealed with seperately, we are simply
-            // expecting COLON.
-            case PARSE_COLON_WAIT: {
-                if (i.token_type != COLON)
-                    throw std::runtime_error("Bad Json: Bad syntax.\n");
-                // Transforming
-                machine_status.top() = PARSE_VALUE_WAIT;
-            } break;
-
-            // Abolished. Dont generate this token.
-            case PARSE_QUOTATION_WAIT: {
-            } break;
-
-            // The init state needs to be dealed with seperately.
-            // There are four targets actually, the syntaxs are as follows:
-            // (a) VALUE. including FLOAT, INTEGER, STRING, BOOLEAN.
-            //      1. FLOAT. We need to transform into PARSING_ARRAY_COMMA_WAIT.
-            //      2. INTEGER. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT.
-            //      3. STRING. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT.
-            //      4. BOOLEAN. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT.
-            // (b) LBRACE. We need to transform into PARSING_ARRAY_COMMA_WAIT,
-            //     and push a PARSE_OBJECT_INIT_CONTENT_WAIT into machine_status.
-            // (c) LBRACKET. We need to transform into PARSING_ARRAY_COMMA_WAIT,
-            //     and push a PARSE_ARRAY_INIT into machine_status.
-            // (d) RBRACKET. Pop machine_status.
-            case PARSE_ARRAY_INIT_CONTENT_WAIT: {
-                switch (i.token_type) {
-                case LBRACE: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    machine_status.push(PARSE_OBJECT_INIT_CONTENT_WAIT);
-                    p->type = OBJECT;
-                    p->child = new jsonobj();
-                    parse_stack.push(p);
-                    p = p->child;
-                } break;
-                case LBRACKET: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    machine_status.push(PARSE_ARRAY_INIT_CONTENT_WAIT);
-                    p->type = ARRAY;
-                    p->child = new jsonobj();
-                    parse_stack.push(p);
-                    p = p->child;
-                } break;
-                case FLOAT: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = FLOAT;
-                    p->obj = atof(i.token_value.c_str());
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case INTEGER: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = INTEGER;
-                    p->obj = atoll(i.token_value.c_str());
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case STRING: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = STRING;
-                    p->obj = i.token_value;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case BOOLEAN: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = BOOLEAN;
-                    if (i.token_value == "true")
-                        p->obj = true;
-                    else if (i.token_value == "false")
-                        p->obj = false;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case RBRACKET: {
-                    machine_status.pop();
-                    p = parse_stack.top();
-                    parse_stack.pop();
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                default:
-                    throw std::runtime_error("Bad Json: Bad token stream.\n");
-                    break;
-                }
-            } break;
+private:
+#ifdef SLOWJSON_HAS_X86_SIMD
+    // The block loop is inlined into these so the classifier is too.
+    __attribute__((target("avx2"))) bool
+    build_avx2(std::string_view text) {
+        return build_blocks<classify_avx2>(text);
+    }
 
-            // For array value parsing, we are expecting these syntaxs:
-            // (a) VALUE. including LBRACE, LBRACKET, FLOAT, INTEGER, STRING,
-            // BOOLEAN.
-            //      1. LBRACE. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT,
-            //         and push a PARSE_OBJECT_INIT_CONTENT_WAIT into
-            //         machine_status.
-            //      2. LBRACKET. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT,
-            //         and push a PARSE_ARRAY_INIT into machine_status.
-            //      3. FLOAT. We need to transform into PARSING_ARRAY_COMMA_WAIT.
-            //      4. INTEGER. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT.
-            //      5. STRING. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT.
-            //      6. BOOLEAN. We need to transform into
-            //      PARSING_ARRAY_COMMA_WAIT.
-            case PARSE_ARRAY_VALUE_WAIT: {
-                switch (i.token_type) {
-                case LBRACE: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    machine_status.push(PARSE_OBJECT_INIT_CONTENT_WAIT);
-                    p->type = OBJECT;
-                    p->child = new jsonobj();
-                    parse_stack.push(p);
-                    p = p->child;
-                } break;
-                case LBRACKET: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    machine_status.push(PARSE_ARRAY_INIT_CONTENT_WAIT);
-                    p->type = ARRAY;
-                    p->child = new jsonobj();
-                    parse_stack.push(p);
-                    p = p->child;
-                } break;
-                case FLOAT: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = FLOAT;
-                    p->obj = atof(i.token_value.c_str());
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case INTEGER: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = INTEGER;
-                    p->obj = atoll(i.token_value.c_str());
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case STRING: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = STRING;
-                    p->obj = i.token_value;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                case BOOLEAN: {
-                    machine_status.top() = PARSE_ARRAY_COMMA_WAIT;
-                    p->type = BOOLEAN;
-                    if (i.token_value == "true")
-                        p->obj = true;
-                    else if (i.token_value == "false")
-                        p->obj = false;
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                default:
-                    throw std::runtime_error("Bad Json: Bad value.\n");
-                }
-            } break;
+    __attribute__((target("sse4.2"))) bool
+    build_sse42(std::string_view text) {
+        return build_blocks<classify_sse42>(text);
+    }
 
-            // For array comma parsing, we are expecting these syntaxs:
-            // (a) COMMA. It shows that there will be more values. Transform into
-            // PARSING_ARRAY_VALUE_WAIT. (b) RBRACKET. It indicates the end of
-            // array. Pop machine_status.
-            case PARSE_ARRAY_COMMA_WAIT: {
-                switch (i.token_type) {
-                case COMMA: {
-                    machine_status.top() = PARSE_ARRAY_VALUE_WAIT;
-                } break;
-                case RBRACKET: {
-                    machine_status.pop();
-                    p = parse_stack.top();
-                    parse_stack.pop();
-                    p->next = new jsonobj();
-                    p = p->next;
-                } break;
-                default:
-                    throw std::runtime_error("Bad Json: Bad syntax.\n");
-                }
-            } break;
+    __attribute__((target("avx2"))) static void
+    split_avx2(std::string_view text, std::vector<std::string_view> &records) {
+        split_blocks<classify_avx2>(text, records);
+    }
 
-            default:
-                throw std::runtime_error("Bad Json: Bad status.\n");
+    __attribute__((target("sse4.2"))) static void
+    split_sse42(std::string_view text,
+                std::vector<std::string_view> &records) {
+        split_blocks<classify_sse42>(text, records);
+    }
+
+    template <typename Visit>
+    __attribute__((target("avx2"))) static bool
+    ops_avx2(std::string_view text, Visit &visit) {
+        return ops_blocks<classify_avx2>(text, visit);
+    }
+
+    template <typename Visit>
+    __attribute__((target("sse4.2"))) static bool
+    ops_sse42(std::string_view text, Visit &visit) {
+        return ops_blocks<classify_sse42>(text, visit);
+    }
+#endif
+
+    template <classifier classify>
+#if defined(__GNUC__)
+    __attribute__((always_inline))
+#endif
+    inline bool
+    build_blocks(std::string_view text) {
+        const char *data = text.data();
+        size_t size = text.size();
+        uint64_t prev_escaped = 0;
+        uint64_t prev_in_string = 0;
+        uint64_t prev_scalar = 0;
+        size_t count = 0;
+        char tail[64];
+        for (size_t base = 0; base < size; base += 64) {
+            const char *block = data + base;
+            if (size - base < 64) {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, block, size - base);
+                block = tail;
+            }
+            block_masks m;
+            classify(block, m);
+
+            uint64_t escaped = find_escaped(m.backslash, prev_escaped);
+            uint64_t quote = m.quote & ~escaped;
+            // Set from an opening quote up to (not including) its closing one.
+            uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+            prev_in_string =
+                static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+            if (m.backslash & ~in_string)
+                return false;
+
+            uint64_t op = m.op & ~in_string;
+            uint64_t scalar = ~(m.op | m.whitespace | m.quote | in_string);
+            uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+            prev_scalar = scalar >> 63;
+
+            uint64_t bits = op | quote | scalar_start;
+            if (positions.size() < count + 64)
+                positions.resize(2 * positions.size());
+            uint32_t *out = positions.data() + count;
+            int found = popcount(bits);
+            count += found;
+            // Most blocks have few entries: write eight unconditionally (the
+            // extra ones are overwritten by the next block), loop for more.
+            uint32_t at = static_cast<uint32_t>(base);
+            for (int k = 0; k < 8; ++k) {
+                out[k] = at + trailing_zeros(bits);
+                bits &= bits - 1;
+            }
+            for (int k = 8; k < found; ++k) {
+                out[k] = at + trailing_zeros(bits);
+                bits &= bits - 1;
+            }
+        }
+        positions.resize(count);
+        return true;
+    }
+
+    template <classifier classify>
+#if defined(__GNUC__)
+    __attribute__((always_inline))
+#endif
+    static inline void
+    split_blocks(std::string_view text,
+                 std::vector<std::string_view> &records) {
+        const char *data = text.data();
+        size_t size = text.size();
+        uint64_t prev_escaped = 0;
+        uint64_t prev_in_string = 0;
+        size_t start = 0;
+        char tail[64];
+        auto add = [&](size_t end) {
+            std::string_view r = text.substr(start, end - start);
+            if (r.find_first_not_of(" \t\r") != std::string_view::npos)
+                records.push_back(r);
+            start = end + 1;
+        };
+        for (size_t base = 0; base < size; base += 64) {
+            const char *block = data + base;
+            if (size - base < 64) {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, block, size - base);
+                block = tail;
+            }
+            block_masks m;
+            classify(block, m);
+            uint64_t escaped = find_escaped(m.backslash, prev_escaped);
+            uint64_t in_string =
+                prefix_xor(m.quote & ~escaped) ^ prev_in_string;
+            prev_in_string =
+                static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+            for (uint64_t bits = m.newline & ~in_string; bits;
+                 bits &= bits - 1)
+                add(base + trailing_zeros(bits));
+        }
+        if (start < size)
+            add(size);
+    }
+
+    template <classifier classify, typename Visit>
+#if defined(__GNUC__)
+    __attribute__((always_inline))
+#endif
+    static inline bool
+    ops_blocks(std::string_view text, Visit &visit) {
+        const char *data = text.data();
+        size_t size = text.size();
+        uint64_t prev_escaped = 0;
+        uint64_t prev_in_string = 0;
+        char tail[64];
+        for (size_t base = 0; base < size; base += 64) {
+            const char *block = data + base;
+            if (size - base < 64) {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, block, size - base);
+                block = tail;
+            }
+            block_masks m;
+            classify(block, m);
+            uint64_t escaped = find_escaped(m.backslash, prev_escaped);
+            uint64_t in_string =
+                prefix_xor(m.quote & ~escaped) ^ prev_in_string;
+            prev_in_string =
+                static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+            for (uint64_t bits = m.op; bits; bits &= bits - 1) {
+                int k = trailing_zeros(bits);
+                if (!visit(base + k, (in_string >> k) & 1))
+                    return prev_in_string != 0;
+            }
+        }
+        return prev_in_string != 0;
+    }
+
+    // Bits of the characters escaped by a backslash. prev_escaped carries a
+    // run of backslashes of odd length ending the previous block.
+    static uint64_t
+    find_escaped(uint64_t backslash, uint64_t &prev_escaped) {
+        const uint64_t even_bits = 0x5555555555555555ULL;
+        const uint64_t odd_bits = ~even_bits;
+        uint64_t start_edges = backslash & ~(backslash << 1);
+        uint64_t even_start_mask = even_bits ^ prev_escaped;
+        uint64_t even_starts = start_edges & even_start_mask;
+        uint64_t odd_starts = start_edges & ~even_start_mask;
+        uint64_t even_carries = backslash + even_starts;
+        uint64_t odd_carries = backslash + odd_starts;
+        bool ends_odd = odd_carries < backslash;
+        odd_carries |= prev_escaped;
+        prev_escaped = ends_odd ? 1 : 0;
+        uint64_t even_carry_ends = even_carries & ~backslash;
+        uint64_t odd_carry_ends = odd_carries & ~backslash;
+        uint64_t even_start_odd_end = even_carry_ends & odd_bits;
+        uint64_t odd_start_even_end = odd_carry_ends & even_bits;
+        return even_start_odd_end | odd_start_even_end;
+    }
+
+    static uint64_t
+    prefix_xor(uint64_t x) {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+        return x;
+    }
+
+    static int
+    popcount(uint64_t x) {
+#if defined(__GNUC__)
+        return __builtin_popcountll(x);
+#else
+        int n = 0;
+        for (; x; x &= x - 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    // Any value for x == 0.
+    static int
+    trailing_zeros(uint64_t x) {
+#if defined(__GNUC__)
+        return x ? __builtin_ctzll(x) : 64;
+#else
+        int n = 0;
+        for (; n < 64 && !(x & 1); x >>= 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    static void
+    classify_scalar(const char *p, block_masks &m) {
+        m.quote = m.backslash = m.op = m.whitespace = m.newline = 0;
+        for (int i = 0; i < 64; ++i) {
+            uint64_t bit = 1ULL << i;
+            switch (p[i]) {
+            case '"':
+                m.quote |= bit;
+                break;
+            case '\\':
+                m.backslash |= bit;
+                break;
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+            case ':':
+            case ',':
+                m.op |= bit;
+                break;
+            case '\n':
+                m.newline |= bit;
+                m.whitespace |= bit;
+                break;
+            case ' ':
+            case '\t':
+            case '\r':
+                m.whitespace |= bit;
                 break;
             }
         }
     }
+
+#ifdef SLOWJSON_HAS_X86_SIMD
+    // '[' and ']' are '{' and '}' with bit 0x20 cleared, so or-ing 0x20 in
+    // folds the four brackets onto two compares.
+    __attribute__((target("sse4.2"))) static void
+    classify_sse42(const char *p, block_masks &m) {
+        m.quote = m.backslash = m.op = m.whitespace = m.newline = 0;
+        for (int k = 0; k < 4; ++k) {
+            __m128i v =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * k));
+            __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            __m128i op = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                             _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+            __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+            __m128i ws = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                _mm_or_si128(nl, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+            int shift = 16 * k;
+            m.quote |= static_cast<uint64_t>(static_cast<uint16_t>(
+                           _mm_movemask_epi8(
+                               _mm_cmpeq_epi8(v, _mm_set1_epi8('"')))))
+                       << shift;
+            m.backslash |= static_cast<uint64_t>(static_cast<uint16_t>(
+                               _mm_movemask_epi8(
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')))))
+                           << shift;
+            m.op |= static_cast<uint64_t>(
+                        static_cast<uint16_t>(_mm_movemask_epi8(op)))
+                    << shift;
+            m.whitespace |= static_cast<uint64_t>(
+                                static_cast<uint16_t>(_mm_movemask_epi8(ws)))
+                            << shift;
+            m.newline |= static_cast<uint64_t>(
+                             static_cast<uint16_t>(_mm_movemask_epi8(nl)))
+                         << shift;
+        }
+    }
+
+    __attribute__((target("avx2"))) static void
+    classify_avx2(const char *p, block_masks &m) {
+        m.quote = m.backslash = m.op = m.whitespace = m.newline = 0;
+        for (int k = 0; k < 2; ++k) {
+            __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(p + 32 * k));
+            __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            __m256i op = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                                _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+            __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+            __m256i ws = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                _mm256_or_si256(nl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+            int shift = 32 * k;
+            m.quote |= static_cast<uint64_t>(static_cast<uint32_t>(
+                           _mm256_movemask_epi8(
+                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')))))
+                       << shift;
+            m.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(
+                               _mm256_movemask_epi8(
+                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')))))
+                           << shift;
+            m.op |= static_cast<uint64_t>(
+                        static_cast<uint32_t>(_mm256_movemask_epi8(op)))
+                    << shift;
+            m.whitespace |= static_cast<uint64_t>(
+                                static_cast<uint32_t>(_mm256_movemask_epi8(ws)))
+                            << shift;
+            m.newline |= static_cast<uint64_t>(
+                             static_cast<uint32_t>(_mm256_movemask_epi8(nl)))
+                         << shift;
+        }
+    }
+#endif
+};
+
+#ifdef SLOWJSON_HAS_MMAP
+/**
+ * @brief Read-only mapping of a whole file.
+ * Unmapped on destruction; views into it must not outlive it.
+ */
+class mapped_file {
+private:
+    const char *data;
+    size_t size;
+
+public:
+    mapped_file() : data(nullptr), size(0) {}
+
+    mapped_file(mapped_file &&other) noexcept
+        : data(other.data), size(other.size) {
+        other.data = nullptr;
+        other.size = 0;
+    }
+
+    mapped_file &
+    operator=(mapped_file &&other) noexcept {
+        if (this != &other) {
+            unmap();
+            data = other.data;
+            size = other.size;
+            other.data = nullptr;
+            other.size = 0;
+        }
+        return *this;
+    }
+
+    ~mapped_file() { unmap(); }
+
+    // Map a regular file. Returns false if fd cannot be mapped.
+    bool
+    map(int fd) {
+        unmap();
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+            return false;
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            return false;
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(p);
+        size = st.st_size;
+        return true;
+    }
+
+    void
+    unmap() {
+        if (data)
+            munmap(const_cast<char *>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+
+    std::string_view
+    view() const {
+        return std::string_view(data, size);
+    }
 };
+#endif
+
+/**
+ * @brief Reads a file in chunks, decompressing it on the way when it is
+ * gzip (or zlib) or zstd compressed.
+ * The format is told by the first bytes of the file; anything else is read
+ * as it is. Only the codecs compiled in are known: SLOWJSON_ZLIB for gzip,
+ * SLOWJSON_ZSTD for zstd. Concatenated members or frames are read one after
+ * the other.
+ */
+class compressed_reader {
+public:
+    enum codec { PLAIN, GZIP, ZSTD };
+
+private:
+    std::ifstream file;
+    std::vector<char> input; // Compressed bytes read ahead
+    size_t input_begin;
+    size_t input_end;
+    bool input_done; // The whole file is in input
+    codec format;
+    bool member_open; // A gzip member or zstd frame is not complete yet
+#ifdef SLOWJSON_ZLIB
+    z_stream zlib;
+#endif
+#ifdef SLOWJSON_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+
+    // Read more of the file after what input holds. Returns false at the
+    // end of the file.
+    bool
+    refill() {
+        if (input_done)
+            return false;
+        if (input_begin == input_end)
+            input_begin = input_end = 0;
+        file.read(input.data() + input_end, input.size() - input_end);
+        size_t n = file.gcount();
+        if (file.bad())
+            throw std::runtime_error("bad file");
+        if (!file)
+            input_done = true;
+        input_end += n;
+        return n != 0;
+    }
+
+    [[noreturn]] static void
+    bad_data() {
+        throw std::runtime_error("bad compressed data");
+    }
+
+#ifdef SLOWJSON_ZLIB
+    size_t
+    read_gzip(char *out, size_t size) {
+        size_t used = 0;
+        while (used < size) {
+            if (input_begin == input_end && !refill()) {
+                if (member_open)
+                    bad_data();
+                break;
+            }
+            if (!member_open) {
+                if (inflateReset(&zlib) != Z_OK)
+                    bad_data();
+                member_open = true;
+            }
+            zlib.next_in = reinterpret_cast<Bytef *>(&input[input_begin]);
+            zlib.avail_in = static_cast<uInt>(std::min<size_t>(
+                input_end - input_begin, std::numeric_limits<uInt>::max()));
+            zlib.next_out = reinterpret_cast<Bytef *>(out + used);
+            zlib.avail_out = static_cast<uInt>(std::min<size_t>(
+                size - used, std::numeric_limits<uInt>::max()));
+            uInt before_in = zlib.avail_in;
+            uInt before_out = zlib.avail_out;
+            int status = inflate(&zlib, Z_NO_FLUSH);
+            input_begin += before_in - zlib.avail_in;
+            used += before_out - zlib.avail_out;
+            if (status == Z_STREAM_END)
+                member_open = false;
+            else if (status != Z_OK && status != Z_BUF_ERROR)
+                bad_data();
+        }
+        return used;
+    }
+#endif
+
+#ifdef SLOWJSON_ZSTD
+    size_t
+    read_zstd(char *out, size_t size) {
+        ZSTD_outBuffer o = {out, size, 0};
+        while (o.pos < size) {
+            if (input_begin == input_end && !refill()) {
+                if (member_open)
+                    bad_data();
+                break;
+            }
+            ZSTD_inBuffer i = {input.data() + input_begin,
+                               input_end - input_begin, 0};
+            size_t hint = ZSTD_decompressStream(zstd, &o, &i);
+            if (ZSTD_isError(hint))
+                bad_data();
+            input_begin += i.pos;
+            member_open = hint != 0;
+        }
+        return o.pos;
+    }
+#endif
+
+public:
+    // Open the file at path and tell its format; throws if it cannot be
+    // read, or is compressed with a codec that is not compiled in.
+    explicit compressed_reader(const std::string &path)
+        : file(path, std::ios::in | std::ios::binary), input(1 << 16),
+          input_begin(0), input_end(0), input_done(false), format(PLAIN),
+          member_open(false) {
+        if (!file.is_open())
+            throw std::runtime_error("bad file");
+        while (input_end < 4 && refill()) {
+        }
+        const unsigned char *magic =
+            reinterpret_cast<const unsigned char *>(input.data());
+        if (input_end >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+            format = GZIP;
+        } else if (input_end >= 2 && magic[0] == 0x78 &&
+                   (magic[0] * 256 + magic[1]) % 31 == 0) {
+            format = GZIP; // A zlib stream
+        } else if (input_end >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+                   magic[2] == 0x2f && magic[3] == 0xfd) {
+            format = ZSTD;
+        }
+#ifdef SLOWJSON_ZLIB
+        if (format == GZIP) {
+            zlib = z_stream();
+            // 32 lets zlib tell gzip from zlib headers.
+            if (inflateInit2(&zlib, 15 + 32) != Z_OK)
+                throw std::bad_alloc();
+        }
+#else
+        if (format == GZIP)
+            throw std::runtime_error("bad file: no gzip support");
+#endif
+#ifdef SLOWJSON_ZSTD
+        zstd = nullptr;
+        if (format == ZSTD) {
+            zstd = ZSTD_createDStream();
+            if (!zstd)
+                throw std::bad_alloc();
+        }
+#else
+        if (format == ZSTD)
+            throw std::runtime_error("bad file: no zstd support");
+#endif
+    }
+
+    compressed_reader(const compressed_reader &) = delete;
+    compressed_reader &operator=(const compressed_reader &) = delete;
+
+    ~compressed_reader() {
+#ifdef SLOWJSON_ZLIB
+        if (format == GZIP)
+            inflateEnd(&zlib);
+#endif
+#ifdef SLOWJSON_ZSTD
+        ZSTD_freeDStream(zstd);
+#endif
+    }
+
+    codec
+    compression() const {
+        return format;
+    }
+
+    // Fill out with the next size bytes of text, fewer only at the end.
+    // Returns how many; 0 once everything was read. Throws on data that
+    // is damaged or cut short.
+    size_t
+    read(char *out, size_t size) {
+        switch (format) {
+#ifdef SLOWJSON_ZLIB
+        case GZIP:
+            return read_gzip(out, size);
+#endif
+#ifdef SLOWJSON_ZSTD
+        case ZSTD:
+            return read_zstd(out, size);
+#endif
+        default:
+            break;
+        }
+        size_t used = 0;
+        while (used < size) {
+            if (input_begin == input_end && !refill())
+                break;
+            size_t n = std::min(size - used, input_end - input_begin);
+            memcpy(out + used, input.data() + input_begin, n);
+            input_begin += n;
+            used += n;
+        }
+        return used;
+    }
+};
+
+/**
+ * @brief A parsed document laid out flat in one array.
+ * Every value is one 8-byte entry in document order, numbers take a second
+ * entry for their bits, and an object member is its key string followed by
+ * its value. Objects and arrays are an open and a close entry pointing at
+ * each other, so a whole subtree is skipped in O(1). String bytes live in a
+ * side buffer, so the tape does not depend on the material.
+ */
+class json_tape {
+public:
+    // The type tag is in the top 8 bits of an entry, the payload below:
+    //   OBJECT, ARRAY   : index after the matching close in the low 32 bits,
+    //                     number of members above (saturating).
+    //   RBRACE, RBRACKET: index of the matching open.
+    //   STRING          : offset into strings of a 32-bit length and bytes.
+    //   INTEGER         : 1 if the next entry is an uint64_t, else int64_t.
+    //   FLOAT           : nothing, the next entry holds the double.
+    //   BOOLEAN         : the value.
+    std::vector<uint64_t> entries;
+    std::string strings;
+
+    void
+    clear() {
+        entries.clear();
+        strings.clear();
+        open_stack.clear();
+    }
+
+    size_t
+    size() const {
+        return entries.size();
+    }
+
+    valuetype
+    type(size_t i) const {
+        return static_cast<valuetype>(entries[i] >> 56);
+    }
+
+    // The entry after the value at i: its next sibling, or the close entry
+    // of its parent.
+    size_t
+    next(size_t i) const {
+        switch (type(i)) {
+        case OBJECT:
+        case ARRAY:
+            return payload(i) & 0xFFFFFFFF;
+        case INTEGER:
+        case FLOAT:
+            return i + 2;
+        default:
+            return i + 1;
+        }
+    }
+
+    // The first member of the container at i; its close entry when empty.
+    size_t
+    first_child(size_t i) const {
+        return i + 1;
+    }
+
+    // The close entry of an open one, or the other way round.
+    size_t
+    match(size_t i) const {
+        if (type(i) == OBJECT || type(i) == ARRAY)
+            return next(i) - 1;
+        return payload(i);
+    }
+
+    // Members of an object or elements of an array, up to 0xFFFFFF.
+    size_t
+    count(size_t i) const {
+        return (payload(i) >> 32) & 0xFFFFFF;
+    }
+
+    std::string_view
+    get_string(size_t i) const {
+        const char *at = strings.data() + payload(i);
+        uint32_t length;
+        memcpy(&length, at, sizeof(length));
+        return std::string_view(at + sizeof(length), length);
+    }
+
+    bool
+    is_unsigned(size_t i) const {
+        return payload(i) != 0;
+    }
+
+    int64_t
+    get_int64(size_t i) const {
+        return static_cast<int64_t>(entries[i + 1]);
+    }
+
+    uint64_t
+    get_uint64(size_t i) const {
+        return entries[i + 1];
+    }
+
+    double
+    get_double(size_t i) const {
+        double d;
+        memcpy(&d, &entries[i + 1], sizeof(d));
+        return d;
+    }
+
+    bool
+    get_bool(size_t i) const {
+        return payload(i) != 0;
+    }
+
+    // Replay the tape as parsing events into a handler (see sax_handler).
+    // Returns false if the handler stopped.
+    template <typename Handler>
+    bool
+    walk(Handler &h) const {
+        std::vector<bool> in_object; // Of each open container
+        bool want_key = false;       // Members of an object start with a name
+        for (size_t i = 0; i < size();) {
+            valuetype t = type(i);
+            bool go = true;
+            if (want_key && t == STRING) {
+                if (!h.key(get_string(i)))
+                    return false;
+                want_key = false;
+                ++i;
+                continue;
+            }
+            switch (t) {
+            case OBJECT: {
+                go = h.start_object();
+                in_object.push_back(true);
+            } break;
+            case ARRAY: {
+                go = h.start_array();
+                in_object.push_back(false);
+            } break;
+            case RBRACE: {
+                go = h.end_object();
+                in_object.pop_back();
+            } break;
+            case RBRACKET: {
+                go = h.end_array();
+                in_object.pop_back();
+            } break;
+            case STRING: {
+                go = h.string(get_string(i));
+            } break;
+            case INTEGER: {
+                go = is_unsigned(i) ? h.uint64(get_uint64(i))
+                                    : h.int64(get_int64(i));
+            } break;
+            case FLOAT: {
+                go = h.float64(get_double(i));
+            } break;
+            case BOOLEAN: {
+                go = h.boolean(get_bool(i));
+            } break;
+            default: {
+                go = h.null();
+            } break;
+            }
+            if (!go)
+                return false;
+            want_key = !in_object.empty() && in_object.back();
+            i = (t == OBJECT || t == ARRAY) ? first_child(i) : next(i);
+        }
+        return true;
+    }
+
+    // Appending, in document order.
+    void
+    open(valuetype type) {
+        counted();
+        open_stack.push_back(entries.size());
+        entries.push_back(tag(type));
+    }
+
+    void
+    close() {
+        size_t o = open_stack.back();
+        open_stack.pop_back();
+        size_t c = entries.size();
+        if (c + 1 > 0xFFFFFFFF)
+            throw std::runtime_error("Bad Json: Too large for a tape.\n");
+        entries.push_back(tag(type(o) == OBJECT ? RBRACE : RBRACKET, o));
+        entries[o] |= c + 1;
+    }
+
+    void
+    append_key(std::string_view s) {
+        push_string(s);
+    }
+
+    void
+    append_string(std::string_view s) {
+        counted();
+        push_string(s);
+    }
+
+    void
+    append_int64(int64_t v) {
+        counted();
+        entries.push_back(tag(INTEGER));
+        entries.push_back(static_cast<uint64_t>(v));
+    }
+
+    void
+    append_uint64(uint64_t v) {
+        counted();
+        entries.push_back(tag(INTEGER, 1));
+        entries.push_back(v);
+    }
+
+    void
+    append_double(double d) {
+        counted();
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        entries.push_back(tag(FLOAT));
+        entries.push_back(bits);
+    }
+
+    void
+    append_bool(bool b) {
+        counted();
+        entries.push_back(tag(BOOLEAN, b));
+    }
+
+    void
+    append_null() {
+        counted();
+        entries.push_back(tag(JSONNULL));
+    }
+
+private:
+    std::vector<size_t> open_stack; // Containers still being appended to
+
+    static uint64_t
+    tag(valuetype type, uint64_t payload = 0) {
+        return static_cast<uint64_t>(type) << 56 | payload;
+    }
+
+    uint64_t
+    payload(size_t i) const {
+        return entries[i] & ((uint64_t(1) << 56) - 1);
+    }
+
+    // One more member for the innermost open container.
+    void
+    counted() {
+        if (open_stack.empty())
+            return;
+        uint64_t &e = entries[open_stack.back()];
+        if (((e >> 32) & 0xFFFFFF) != 0xFFFFFF)
+            e += uint64_t(1) << 32;
+    }
+
+    void
+    push_string(std::string_view s) {
+        if (s.size() > 0xFFFFFFFF)
+            throw std::runtime_error("Bad Json: Too large for a tape.\n");
+        uint32_t length = static_cast<uint32_t>(s.size());
+        entries.push_back(tag(STRING, strings.size()));
+        strings.append(reinterpret_cast<const char *>(&length), sizeof(length));
+        strings.append(s.data(), s.size());
+    }
+};
+
+/**
+ * @brief Receiver of parsing events, in document order.
+ * json_storage::parse_sax() takes any type with these members as a template
+ * parameter, so a handler may derive from this one and only redefine the
+ * events it cares about. Every event returns false to stop parsing there.
+ * Strings are only valid during the call.
+ */
+struct sax_handler {
+    bool start_object() { return true; }
+    bool end_object() { return true; }
+    bool start_array() { return true; }
+    bool end_array() { return true; }
+    bool key(std::string_view) { return true; }
+    bool string(std::string_view) { return true; }
+    bool int64(int64_t) { return true; }
+    bool uint64(uint64_t) { return true; } // Only above INT64_MAX
+    bool float64(double) { return true; }
+    bool boolean(bool) { return true; }
+    bool null() { return true; }
+};
+
+/**
+ * @brief Writes json text from parsing events (see sax_handler).
+ * Drive it with jsonobj::walk(), json_tape::walk() or parse_sax(). Output
+ * is compact, or indented by indent spaces per level when indent > 0. It is
+ * appended to a string, or written to a file descriptor through a buffer
+ * flushed every flush_bytes, so a big tree is not held twice in memory.
+ */
+class json_writer {
+    friend class json_validator;
+
+private:
+    std::string buffer; // Used for a file descriptor
+    std::string &out;
+    int fd;
+    int indent;
+    int depth;
+    bool first;     // Nothing written yet in the current container
+    bool after_key; // The next value goes right after its key
+
+    static constexpr size_t flush_bytes = 1 << 16;
+
+public:
+    explicit json_writer(std::string &to, int indent = 0)
+        : out(to), fd(-1), indent(indent), depth(0), first(true),
+          after_key(false) {}
+
+#ifdef SLOWJSON_HAS_MMAP
+    explicit json_writer(int to, int indent = 0)
+        : out(buffer), fd(to), indent(indent), depth(0), first(true),
+          after_key(false) {
+        buffer.reserve(flush_bytes + 4096);
+    }
+#endif
+
+    json_writer(const json_writer &) = delete;
+    json_writer &operator=(const json_writer &) = delete;
+
+    // Write out what is buffered for the file descriptor. Call it once the
+    // last event is in.
+    void
+    flush() {
+#ifdef SLOWJSON_HAS_MMAP
+        if (fd < 0)
+            return;
+        const char *p = out.data();
+        size_t left = out.size();
+        while (left) {
+            ssize_t n = ::write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("bad fd");
+            }
+            p += n;
+            left -= n;
+        }
+        out.clear();
+#endif
+    }
+
+    bool start_object() { return open('{'); }
+    bool end_object() { return close('}'); }
+    bool start_array() { return open('['); }
+    bool end_array() { return close(']'); }
+
+    bool
+    key(std::string_view name) {
+        separate();
+        quote(name);
+        out.push_back(':');
+        if (indent > 0)
+            out.push_back(' ');
+        after_key = true;
+        return true;
+    }
+
+    bool
+    string(std::string_view s) {
+        separate();
+        quote(s);
+        return written();
+    }
+
+    bool
+    int64(int64_t i) {
+        separate();
+        char tmp[24];
+        out.append(tmp, std::to_chars(tmp, tmp + sizeof(tmp), i).ptr);
+        return written();
+    }
+
+    bool
+    uint64(uint64_t u) {
+        separate();
+        char tmp[24];
+        out.append(tmp, std::to_chars(tmp, tmp + sizeof(tmp), u).ptr);
+        return written();
+    }
+
+    // Shortest text that reads back as the same double, kept a number with
+    // a fraction or exponent so it reads back as FLOAT. Infinities and NaN
+    // have no json spelling and are written as null.
+    bool
+    float64(double d) {
+        separate();
+        if (!std::isfinite(d)) {
+            out.append("null");
+            return written();
+        }
+        char tmp[32];
+        char *end = std::to_chars(tmp, tmp + sizeof(tmp), d).ptr;
+        out.append(tmp, end);
+        if (std::find_if(tmp, end, [](char c) {
+                return c == '.' || c == 'e';
+            }) == end)
+            out.append(".0");
+        return written();
+    }
+
+    bool
+    boolean(bool b) {
+        separate();
+        out.append(b ? "true" : "false");
+        return written();
+    }
+
+    bool
+    null() {
+        separate();
+        out.append("null");
+        return written();
+    }
+
+private:
+    void
+    newline() {
+        out.push_back('\n');
+        out.append(static_cast<size_t>(indent) * depth, ' ');
+    }
+
+    // Comma and line break before a value or key.
+    void
+    separate() {
+        if (after_key) {
+            after_key = false;
+            return;
+        }
+        if (!first)
+            out.push_back(',');
+        first = false;
+        if (indent > 0 && depth > 0)
+            newline();
+    }
+
+    bool
+    open(char c) {
+        separate();
+        out.push_back(c);
+        ++depth;
+        first = true;
+        return written();
+    }
+
+    // An empty container stays on one line.
+    bool
+    close(char c) {
+        --depth;
+        if (!first && indent > 0)
+            newline();
+        out.push_back(c);
+        first = false;
+        return written();
+    }
+
+    bool
+    written() {
+        if (fd >= 0 && out.size() >= flush_bytes)
+            flush();
+        return true;
+    }
+
+    void
+    quote(std::string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        out.push_back('"');
+        const char *p = s.data();
+        size_t left = s.size();
+        for (;;) {
+            size_t run = escape_free(p, left);
+            out.append(p, run);
+            p += run;
+            left -= run;
+            if (!left)
+                break;
+            unsigned char c = *p++;
+            --left;
+            switch (c) {
+            case '"':
+                out.append("\\\"");
+                break;
+            case '\\':
+                out.append("\\\\");
+                break;
+            case '\b':
+                out.append("\\b");
+                break;
+            case '\f':
+                out.append("\\f");
+                break;
+            case '\n':
+                out.append("\\n");
+                break;
+            case '\r':
+                out.append("\\r");
+                break;
+            case '\t':
+                out.append("\\t");
+                break;
+            default: {
+                char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                out.append(u, sizeof(u));
+            } break;
+            }
+        }
+        out.push_back('"');
+        if (fd >= 0 && out.size() >= flush_bytes)
+            flush();
+    }
+
+    static bool
+    needs_escape(unsigned char c) {
+        return c < 0x20 || c == '"' || c == '\\';
+    }
+
+    // Length of the prefix of p that can be copied as it is. Short strings
+    // are not worth the vector setup.
+    static size_t
+    escape_free(const char *p, size_t n) {
+#ifdef SLOWJSON_HAS_X86_SIMD
+        if (n >= 32) {
+            switch (structural_index::best_level()) {
+            case SIMD_AVX2:
+                return escape_free_avx2(p, n);
+            case SIMD_SSE42:
+                return escape_free_sse42(p, n);
+            default:
+                break;
+            }
+        }
+#endif
+        return escape_free_scalar(p, 0, n);
+    }
+
+    static size_t
+    escape_free_scalar(const char *p, size_t i, size_t n) {
+        while (i < n && !needs_escape(p[i]))
+            ++i;
+        return i;
+    }
+
+#ifdef SLOWJSON_HAS_X86_SIMD
+    // Control characters are the bytes equal to their max with 0x1f.
+    __attribute__((target("avx2"))) static size_t
+    escape_free_avx2(const char *p, size_t n) {
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i v =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+            __m256i bad = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1f)),
+                                  _mm256_set1_epi8(0x1f)));
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(bad));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return escape_free_scalar(p, i, n);
+    }
+
+    __attribute__((target("sse4.2"))) static size_t
+    escape_free_sse42(const char *p, size_t n) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            __m128i bad = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1f)),
+                               _mm_set1_epi8(0x1f)));
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(bad));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return escape_free_scalar(p, i, n);
+    }
+#endif
+};
+
+// What json_validator::validate() found. offset is the byte where the first
+// error is, the size of the text when the text ends too early.
+struct validation_result {
+    bool ok;
+    size_t offset;
+    const char *error; // Same wording as the exceptions of the parser
+
+    explicit operator bool() const { return ok; }
+};
+
+/**
+ * @brief Checks that a text is json without tokenizing or building anything.
+ * The grammar is checked by walking the entries of a structural_index, with
+ * only a stack of open brackets kept; strings and scalars are checked in
+ * place. UTF-8 is checked separately over the whole text, 64 bytes at a
+ * time with the lookup tables of Keiser and Lemire ("Validating UTF-8 in
+ * less than one instruction per byte"). Both buffers keep their capacity,
+ * so a validator that is reused does not allocate.
+ * The rules are RFC 8259 plus those of the parser: the top level is an
+ * object or an array. It is stricter than the parser about what the parser
+ * lets through: ill-formed UTF-8, control characters inside strings, and
+ * anything but whitespace after the top-level value.
+ */
+class json_validator {
+private:
+    structural_index structural;
+    std::vector<char> scopes; // '{' or '[' of every open container
+
+    enum expect {
+        EXPECT_ROOT,
+        EXPECT_VALUE,
+        EXPECT_VALUE_OR_CLOSE, // Right after '['
+        EXPECT_KEY,
+        EXPECT_KEY_OR_CLOSE, // Right after '{'
+        EXPECT_COLON,
+        EXPECT_COMMA_OR_CLOSE,
+        EXPECT_NOTHING, // The top-level value is complete
+    };
+
+public:
+    validation_result
+    validate(std::string_view text, simd_level level = SIMD_BEST) {
+        validation_result r;
+        if (structural.build(text, level)) {
+            const std::vector<uint32_t> &index = structural.positions;
+            size_t e = 0;
+            r = check(text, [&](size_t &pos) {
+                if (e == index.size())
+                    return false;
+                pos = index[e++];
+                return true;
+            });
+        } else {
+            // Too long for the index, or a backslash outside of a string:
+            // find the same entries byte by byte.
+            r = check(text, scalar_entries(text));
+        }
+        if (!utf8_valid(text, level)) {
+            size_t bad = utf8_error(text);
+            if (r.ok || bad < r.offset)
+                r = {false, bad, "Bad Json: Bad UTF-8.\n"};
+        }
+        return r;
+    }
+
+    // Offset of the first byte of the first ill-formed UTF-8 sequence in
+    // text, the size of text if there is none. Overlong forms, surrogates
+    // and code points above U+10FFFF are ill-formed.
+    static size_t
+    utf8_error(std::string_view text) {
+        const unsigned char *p =
+            reinterpret_cast<const unsigned char *>(text.data());
+        size_t n = text.size();
+        size_t i = 0;
+        while (i < n) {
+            // Eight ASCII bytes at a time.
+            uint64_t word;
+            if (i + 8 <= n && (memcpy(&word, p + i, 8),
+                               !(word & 0x8080808080808080ULL))) {
+                i += 8;
+                continue;
+            }
+            unsigned char c = p[i];
+            if (c < 0x80) {
+                ++i;
+                continue;
+            }
+            size_t length;
+            unsigned char low = 0x80, high = 0xBF; // Range of the 2nd byte
+            if (c >= 0xC2 && c <= 0xDF) {
+                length = 2;
+            } else if (c >= 0xE0 && c <= 0xEF) {
+                length = 3;
+                if (c == 0xE0)
+                    low = 0xA0;
+                else if (c == 0xED)
+                    high = 0x9F;
+            } else if (c >= 0xF0 && c <= 0xF4) {
+                length = 4;
+                if (c == 0xF0)
+                    low = 0x90;
+                else if (c == 0xF4)
+                    high = 0x8F;
+            } else {
+                return i;
+            }
+            if (n - i < length || p[i + 1] < low || p[i + 1] > high)
+                return i;
+            for (size_t k = 2; k < length; ++k) {
+                if ((p[i + k] & 0xC0) != 0x80)
+                    return i;
+            }
+            i += length;
+        }
+        return n;
+    }
+
+    // Whether text is well-formed UTF-8.
+    static bool
+    utf8_valid(std::string_view text, simd_level level = SIMD_BEST) {
+        if (level == SIMD_BEST || level > structural_index::best_level())
+            level = structural_index::best_level();
+        switch (level) {
+#ifdef SLOWJSON_HAS_X86_SIMD
+        case SIMD_AVX2:
+            return utf8_avx2(text.data(), text.size());
+        case SIMD_SSE42:
+            return utf8_sse42(text.data(), text.size());
+#endif
+        default:
+            return utf8_error(text) == text.size();
+        }
+    }
+
+private:
+    static validation_result
+    fail(size_t offset, const char *error) {
+        return {false, offset, error};
+    }
+
+    // Entries like those of structural_index (structural characters,
+    // quotes and the first byte of every other run), found one byte at a
+    // time.
+    struct scalar_entries {
+        std::string_view text;
+        size_t i = 0;
+        bool in_string = false;
+
+        explicit scalar_entries(std::string_view t) : text(t) {}
+
+        bool
+        operator()(size_t &pos) {
+            while (i < text.size()) {
+                char c = text[i];
+                if (in_string) {
+                    if (c == '\\') {
+                        i += 2;
+                        continue;
+                    }
+                    if (c == '"') {
+                        in_string = false;
+                        pos = i++;
+                        return true;
+                    }
+                    ++i;
+                    continue;
+                }
+                switch (c) {
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\r': {
+                    ++i;
+                } break;
+                case '"': {
+                    in_string = true;
+                    pos = i++;
+                    return true;
+                } break;
+                case '{':
+                case '}':
+                case '[':
+                case ']':
+                case ':':
+                case ',': {
+                    pos = i++;
+                    return true;
+                } break;
+                default: {
+                    pos = i;
+                    while (++i < text.size() && !tokenizer::ends_run(text[i]))
+                        ;
+                    return true;
+                }
+                }
+            }
+            return false;
+        }
+    };
+
+    // The grammar machine, fed with the offsets of the entries by next.
+    template <typename Next>
+    validation_result
+    check(std::string_view text, Next &&next) {
+        scopes.clear();
+        expect state = EXPECT_ROOT;
+        size_t pos;
+        while (next(pos)) {
+            char c = text[pos];
+            switch (state) {
+            case EXPECT_ROOT: {
+                if (c != '{' && c != '[')
+                    return fail(pos, "Bad Json: Illegal value.\n");
+                scopes.push_back(c);
+                state = c == '{' ? EXPECT_KEY_OR_CLOSE : EXPECT_VALUE_OR_CLOSE;
+            } break;
+            case EXPECT_VALUE_OR_CLOSE:
+            case EXPECT_VALUE: {
+                if (c == ']' && state == EXPECT_VALUE_OR_CLOSE) {
+                    scopes.pop_back();
+                    state = after_value();
+                    break;
+                }
+                switch (c) {
+                case '{': {
+                    scopes.push_back(c);
+                    state = EXPECT_KEY_OR_CLOSE;
+                } break;
+                case '[': {
+                    scopes.push_back(c);
+                    state = EXPECT_VALUE_OR_CLOSE;
+                } break;
+                case '"': {
+                    validation_result r = check_string(text, pos, next);
+                    if (!r.ok)
+                        return r;
+                    state = after_value();
+                } break;
+                case '}':
+                case ']':
+                case ':':
+                case ',':
+                    return fail(pos, "Bad Json: Bad syntax.\n");
+                default: {
+                    validation_result r = check_scalar(text, pos);
+                    if (!r.ok)
+                        return r;
+                    state = after_value();
+                }
+                }
+            } break;
+            case EXPECT_KEY_OR_CLOSE:
+            case EXPECT_KEY: {
+                if (c == '}' && state == EXPECT_KEY_OR_CLOSE) {
+                    scopes.pop_back();
+                    state = after_value();
+                    break;
+                }
+                if (c != '"')
+                    return fail(pos, "Bad Json: Bad syntax.\n");
+                validation_result r = check_string(text, pos, next);
+                if (!r.ok)
+                    return r;
+                state = EXPECT_COLON;
+            } break;
+            case EXPECT_COLON: {
+                if (c != ':')
+                    return fail(pos, "Bad Json: Bad syntax.\n");
+                state = EXPECT_VALUE;
+            } break;
+            case EXPECT_COMMA_OR_CLOSE: {
+                if (c == ',') {
+                    state = scopes.back() == '{' ? EXPECT_KEY : EXPECT_VALUE;
+                } else if (c == '}' || c == ']') {
+                    if (scopes.back() != (c == '}' ? '{' : '['))
+                        return fail(pos, "Bad Json: Bad brackets.\n");
+                    scopes.pop_back();
+                    state = after_value();
+                } else {
+                    return fail(pos, "Bad Json: Bad syntax.\n");
+                }
+            } break;
+            case EXPECT_NOTHING:
+                return fail(pos, "Bad Json: Trailing content.\n");
+            }
+        }
+        if (state != EXPECT_NOTHING)
+            return fail(text.size(), "Bad Json: Unexpected end.\n");
+        return {true, text.size(), ""};
+    }
+
+    expect
+    after_value() const {
+        return scopes.empty() ? EXPECT_NOTHING : EXPECT_COMMA_OR_CLOSE;
+    }
+
+    // The string opening at pos, up to the quote of the next entry: no raw
+    // control characters, and escapes as the tokenizer takes them.
+    template <typename Next>
+    static validation_result
+    check_string(std::string_view text, size_t pos, Next &next) {
+        size_t close;
+        if (!next(close))
+            return fail(text.size(), "Bad Json: Unexpected end.\n");
+        const char *p = text.data();
+        size_t i = pos + 1;
+        bool high_surrogate = false;
+        while (i < close) {
+            size_t run = json_writer::escape_free(p + i, close - i);
+            if (high_surrogate && run)
+                return fail(i, "Bad Json: Bad escape.\n");
+            i += run;
+            if (i == close)
+                break;
+            if (p[i] != '\\')
+                return fail(i, "Bad Json: Bad string.\n");
+            // A backslash never comes last: it would escape the quote.
+            char c = p[i + 1];
+            if (high_surrogate && c != 'u')
+                return fail(i, "Bad Json: Bad escape.\n");
+            switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't': {
+                i += 2;
+            } break;
+            case 'u': {
+                uint32_t value = 0;
+                for (size_t k = i + 2; k < i + 6; ++k) {
+                    int digit = k < close ? tokenizer::hex_digit(p[k]) : -1;
+                    if (digit < 0)
+                        return fail(i, "Bad Json: Bad escape.\n");
+                    value = value * 16 + digit;
+                }
+                bool low = value >= 0xDC00 && value <= 0xDFFF;
+                if (low != high_surrogate)
+                    return fail(i, "Bad Json: Bad escape.\n");
+                high_surrogate = value >= 0xD800 && value <= 0xDBFF;
+                i += 6;
+            } break;
+            default:
+                return fail(i, "Bad Json: Bad escape.\n");
+            }
+        }
+        if (high_surrogate)
+            return fail(close, "Bad Json: Bad escape.\n");
+        return {true, close, ""};
+    }
+
+    // The number or literal starting at pos, which has to end where its
+    // run of bytes does.
+    static validation_result
+    check_scalar(std::string_view text, size_t pos) {
+        const char *p = text.data();
+        size_t n = text.size();
+        size_t q = pos + 1;
+        switch (p[pos]) {
+        case '-':
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9': {
+            valuetype status = tokenizer::number_start(p[pos]);
+            for (; q < n; ++q) {
+                valuetype next = tokenizer::number_step(status, p[q]);
+                if (next == TOKENIZE_IDLE)
+                    break;
+                status = next;
+            }
+            if (!tokenizer::number_complete(status) ||
+                (q < n && !tokenizer::ends_run(p[q])))
+                return fail(q, "Bad Json: Bad numbers.\n");
+        } break;
+        case 't':
+        case 'f':
+        case 'n': {
+            std::string_view word = p[pos] == 't'   ? "true"
+                                    : p[pos] == 'f' ? "false"
+                                                    : "null";
+            for (; q < pos + word.size(); ++q) {
+                if (q == n || p[q] != word[q - pos])
+                    return fail(q, "Bad Json: Bad syntax.\n");
+            }
+            if (q < n && !tokenizer::ends_run(p[q]))
+                return fail(q, "Bad Json: Bad tokens.\n");
+        } break;
+        default:
+            return fail(pos, "Bad Json: Bad tokens.\n");
+        }
+        return {true, q, ""};
+    }
+
+    // Classes of the first byte before (byte_1_*) and of the byte itself
+    // (byte_2_high) by nibble; a bit set in all three is an error.
+    enum : uint8_t {
+        TOO_SHORT = 1 << 0,
+        TOO_LONG = 1 << 1,
+        OVERLONG_3 = 1 << 2,
+        TOO_LARGE = 1 << 3,
+        SURROGATE = 1 << 4,
+        OVERLONG_2 = 1 << 5,
+        TOO_LARGE_1000 = 1 << 6,
+        OVERLONG_4 = 1 << 6,
+        TWO_CONTS = 1 << 7,
+        CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS,
+    };
+
+    static const uint8_t *
+    utf8_tables() {
+        static const uint8_t tables[48] = {
+            // byte_1_high
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TOO_LONG, TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2, TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+            // byte_1_low
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            CARRY | OVERLONG_2, CARRY, CARRY, CARRY | TOO_LARGE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            // byte_2_high
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_SHORT, TOO_SHORT,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+                 OVERLONG_4,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        };
+        return tables;
+    }
+
+#ifdef SLOWJSON_HAS_X86_SIMD
+    // Error bits of the 32 bytes of v, prev holding the 32 bytes before.
+    __attribute__((target("avx2"))) static __m256i
+    utf8_errors_avx2(__m256i v, __m256i prev) {
+        const __m128i *t = reinterpret_cast<const __m128i *>(utf8_tables());
+        const __m256i byte_1_high =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(t));
+        const __m256i byte_1_low =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(t + 1));
+        const __m256i byte_2_high =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(t + 2));
+        const __m256i nibble = _mm256_set1_epi8(0x0F);
+        __m256i before = _mm256_permute2x128_si256(prev, v, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(v, before, 15);
+        __m256i prev2 = _mm256_alignr_epi8(v, before, 14);
+        __m256i prev3 = _mm256_alignr_epi8(v, before, 13);
+        __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(
+                    byte_1_high,
+                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(byte_1_low,
+                                    _mm256_and_si256(prev1, nibble))),
+            _mm256_shuffle_epi8(
+                byte_2_high,
+                _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+        // Third and fourth bytes of a sequence must be continuations, and
+        // only they may follow two continuations.
+        __m256i must_continue = _mm256_and_si256(
+            _mm256_or_si256(
+                _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xE0 - 0x80))),
+                _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xF0 - 0x80)))),
+            _mm256_set1_epi8(char(0x80)));
+        return _mm256_xor_si256(must_continue, special);
+    }
+
+    // Nonzero when the last bytes of v start a sequence that goes on.
+    __attribute__((target("avx2"))) static __m256i
+    utf8_incomplete_avx2(__m256i v) {
+        const __m256i max = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xF0 - 1),
+            char(0xE0 - 1), char(0xC0 - 1));
+        return _mm256_subs_epu8(v, max);
+    }
+
+    __attribute__((target("avx2"))) static bool
+    utf8_avx2(const char *p, size_t n) {
+        __m256i error = _mm256_setzero_si256();
+        __m256i prev = _mm256_setzero_si256();
+        __m256i incomplete = _mm256_setzero_si256();
+        char tail[64];
+        for (size_t base = 0; base < n; base += 64) {
+            const char *block = p + base;
+            if (n - base < 64) {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, block, n - base);
+                block = tail;
+            }
+            __m256i a =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+            __m256i b = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(block + 32));
+            if (!_mm256_movemask_epi8(_mm256_or_si256(a, b))) {
+                // All ASCII: only a sequence cut at the end of the last
+                // block can be wrong.
+                error = _mm256_or_si256(error, incomplete);
+                prev = b;
+                incomplete = _mm256_setzero_si256();
+                continue;
+            }
+            error = _mm256_or_si256(error, utf8_errors_avx2(a, prev));
+            error = _mm256_or_si256(error, utf8_errors_avx2(b, a));
+            prev = b;
+            incomplete = utf8_incomplete_avx2(b);
+        }
+        error = _mm256_or_si256(error, incomplete);
+        return _mm256_testz_si256(error, error);
+    }
+
+    __attribute__((target("sse4.2"))) static __m128i
+    utf8_errors_sse42(__m128i v, __m128i prev) {
+        const __m128i *t = reinterpret_cast<const __m128i *>(utf8_tables());
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+        __m128i prev1 = _mm_alignr_epi8(v, prev, 15);
+        __m128i prev2 = _mm_alignr_epi8(v, prev, 14);
+        __m128i prev3 = _mm_alignr_epi8(v, prev, 13);
+        __m128i special = _mm_and_si128(
+            _mm_and_si128(
+                _mm_shuffle_epi8(_mm_loadu_si128(t),
+                                 _mm_and_si128(_mm_srli_epi16(prev1, 4),
+                                               nibble)),
+                _mm_shuffle_epi8(_mm_loadu_si128(t + 1),
+                                 _mm_and_si128(prev1, nibble))),
+            _mm_shuffle_epi8(_mm_loadu_si128(t + 2),
+                             _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+        __m128i must_continue = _mm_and_si128(
+            _mm_or_si128(
+                _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0 - 0x80))),
+                _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0 - 0x80)))),
+            _mm_set1_epi8(char(0x80)));
+        return _mm_xor_si128(must_continue, special);
+    }
+
+    __attribute__((target("sse4.2"))) static bool
+    utf8_sse42(const char *p, size_t n) {
+        const __m128i max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1, -1, -1, char(0xF0 - 1),
+                                          char(0xE0 - 1), char(0xC0 - 1));
+        __m128i error = _mm_setzero_si128();
+        __m128i prev = _mm_setzero_si128();
+        __m128i incomplete = _mm_setzero_si128();
+        char tail[64];
+        for (size_t base = 0; base < n; base += 64) {
+            const char *block = p + base;
+            if (n - base < 64) {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, block, n - base);
+                block = tail;
+            }
+            __m128i v[4];
+            for (int k = 0; k < 4; ++k)
+                v[k] = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(block + 16 * k));
+            __m128i any = _mm_or_si128(_mm_or_si128(v[0], v[1]),
+                                       _mm_or_si128(v[2], v[3]));
+            if (!_mm_movemask_epi8(any)) {
+                error = _mm_or_si128(error, incomplete);
+                prev = v[3];
+                incomplete = _mm_setzero_si128();
+                continue;
+            }
+            for (int k = 0; k < 4; ++k) {
+                error = _mm_or_si128(error, utf8_errors_sse42(v[k], prev));
+                prev = v[k];
+            }
+            incomplete = _mm_subs_epu8(v[3], max);
+        }
+        error = _mm_or_si128(error, incomplete);
+        return _mm_testz_si128(error, error);
+    }
+#endif
+};
+
+class compact_value;
+
+/**
+ * @brief A parsed document in 16 bytes per value.
+ * Nodes sit in one array in document order, each with its type, the id of
+ * its member name in a key_pool, and an 8-byte payload holding numbers,
+ * booleans and strings of up to 8 bytes inline. Longer strings live in a
+ * side buffer. An object or array stores the index after its subtree and
+ * its member count, so siblings are found without pointers. Read it through
+ * compact_value, which has the accessors of jsonobj as member functions.
+ * Fill it with json_storage::parse_compact(), or from an existing tree with
+ * jsonobj::walk(), the tree being a handler of parsing events.
+ */
+class compact_tree {
+public:
+    struct node {
+        uint8_t type;     // A valuetype
+        uint8_t length;   // Of an inline string; long_string when out of line.
+                          // 1 for an INTEGER above INT64_MAX
+        uint16_t unused;
+        uint32_t key;     // Id of the member name, 0 if it has none
+        uint64_t payload; // OBJECT, TOP, ARRAY: index after the subtree in
+                          // the low 32 bits, member count above.
+                          // STRING: the bytes, or offset and size in strings
+    };
+    static_assert(sizeof(node) == 16, "compact_tree::node is 16 bytes");
+
+    static constexpr uint8_t long_string = 0xFF;
+
+    std::vector<node> nodes;
+    std::string strings;
+
+    explicit compact_tree(
+        std::shared_ptr<key_pool> pool = std::make_shared<key_pool>())
+        : keys(std::move(pool)), key_tmp(0) {}
+
+    void
+    clear() {
+        nodes.clear();
+        strings.clear();
+        open_stack.clear();
+        key_tmp = 0;
+    }
+
+    size_t
+    size() const {
+        return nodes.size();
+    }
+
+    // The pool of member names, possibly shared with other trees.
+    const key_pool &
+    names() const {
+        return *keys;
+    }
+
+    // The top-level object or array.
+    compact_value
+    root() const;
+
+    // The node after the subtree at i.
+    size_t
+    next(size_t i) const {
+        const node &n = nodes[i];
+        if (n.type == OBJECT || n.type == TOP || n.type == ARRAY)
+            return n.payload & 0xFFFFFFFF;
+        return i + 1;
+    }
+
+    size_t
+    count(size_t i) const {
+        return nodes[i].payload >> 32;
+    }
+
+    std::string_view
+    get_string(size_t i) const {
+        const node &n = nodes[i];
+        if (n.length != long_string)
+            return std::string_view(reinterpret_cast<const char *>(&n.payload),
+                                    n.length);
+        return std::string_view(strings.data() + (n.payload & 0xFFFFFFFF),
+                                n.payload >> 32);
+    }
+
+    int64_t
+    get_int64(size_t i) const {
+        return static_cast<int64_t>(nodes[i].payload);
+    }
+
+    uint64_t
+    get_uint64(size_t i) const {
+        return nodes[i].payload;
+    }
+
+    double
+    get_double(size_t i) const {
+        double d;
+        memcpy(&d, &nodes[i].payload, sizeof(d));
+        return d;
+    }
+
+    // Replay the tree as parsing events into a handler (see sax_handler).
+    // Returns false if the handler stopped.
+    template <typename Handler>
+    bool
+    walk(Handler &h) const {
+        std::vector<std::pair<size_t, bool>> open; // End and kind of each
+                                                   // open container
+        for (size_t i = 0; i < size() || !open.empty();) {
+            if (!open.empty() && i == open.back().first) {
+                bool object = open.back().second;
+                open.pop_back();
+                if (!(object ? h.end_object() : h.end_array()))
+                    return false;
+                continue;
+            }
+            const node &n = nodes[i];
+            if (n.key && !h.key(keys->name(n.key)))
+                return false;
+            bool go = true;
+            switch (n.type) {
+            case TOP:
+            case OBJECT:
+            case ARRAY: {
+                bool object = n.type != ARRAY;
+                go = object ? h.start_object() : h.start_array();
+                open.emplace_back(next(i), object);
+            } break;
+            case STRING: {
+                go = h.string(get_string(i));
+            } break;
+            case INTEGER: {
+                go = n.length ? h.uint64(get_uint64(i)) : h.int64(get_int64(i));
+            } break;
+            case FLOAT: {
+                go = h.float64(get_double(i));
+            } break;
+            case BOOLEAN: {
+                go = h.boolean(n.payload != 0);
+            } break;
+            default: {
+                go = h.null();
+            } break;
+            }
+            if (!go)
+                return false;
+            ++i;
+        }
+        return true;
+    }
+
+    // Parsing events, appending in document order.
+    bool start_object() { return open(OBJECT); }
+    bool start_array() { return open(ARRAY); }
+    bool end_object() { return close(); }
+    bool end_array() { return close(); }
+
+    bool
+    key(std::string_view name) {
+        key_tmp = keys->intern(name);
+        return true;
+    }
+
+    bool
+    string(std::string_view s) {
+        node &n = append(STRING);
+        if (s.size() <= sizeof(n.payload)) {
+            n.length = static_cast<uint8_t>(s.size());
+            if (!s.empty())
+                memcpy(&n.payload, s.data(), s.size());
+        } else {
+            if (strings.size() > 0xFFFFFFFF ||
+                s.size() > 0xFFFFFFFF)
+                throw std::runtime_error(
+                    "Bad Json: Too large for a compact tree.\n");
+            n.length = long_string;
+            n.payload = uint64_t(s.size()) << 32 | strings.size();
+            strings.append(s.data(), s.size());
+        }
+        return true;
+    }
+
+    bool
+    int64(int64_t i) {
+        append(INTEGER).payload = static_cast<uint64_t>(i);
+        return true;
+    }
+
+    bool
+    uint64(uint64_t u) {
+        node &n = append(INTEGER);
+        n.length = 1;
+        n.payload = u;
+        return true;
+    }
+
+    bool
+    float64(double d) {
+        memcpy(&append(FLOAT).payload, &d, sizeof(d));
+        return true;
+    }
+
+    bool
+    boolean(bool b) {
+        append(BOOLEAN).payload = b;
+        return true;
+    }
+
+    bool
+    null() {
+        append(JSONNULL);
+        return true;
+    }
+
+private:
+    std::shared_ptr<key_pool> keys;
+    std::vector<size_t> open_stack; // Containers still being appended to
+    uint32_t key_tmp;               // Name of the next node
+
+    // A new node, counted as a member of the innermost open container.
+    node &
+    append(valuetype type) {
+        if (nodes.size() >= 0xFFFFFFFF)
+            throw std::runtime_error(
+                "Bad Json: Too large for a compact tree.\n");
+        if (!open_stack.empty())
+            nodes[open_stack.back()].payload += uint64_t(1) << 32;
+        nodes.push_back(node{static_cast<uint8_t>(type), 0, 0, key_tmp, 0});
+        key_tmp = 0;
+        return nodes.back();
+    }
+
+    // The top-level object is TOP, as in the jsonobj tree.
+    bool
+    open(valuetype type) {
+        if (open_stack.empty() && type == OBJECT)
+            type = TOP;
+        append(type);
+        open_stack.push_back(nodes.size() - 1);
+        return true;
+    }
+
+    bool
+    close() {
+        nodes[open_stack.back()].payload |= nodes.size();
+        open_stack.pop_back();
+        return true;
+    }
+};
+
+/**
+ * @brief A value of a compact_tree, with the accessors of jsonobj.
+ * It is a tree and a node index, cheap to copy, and valid as long as the
+ * tree is not changed.
+ */
+class compact_value {
+private:
+    const compact_tree *tree;
+    size_t entry; // Index of the node
+
+public:
+    compact_value(const compact_tree *t, size_t i) : tree(t), entry(i) {}
+
+    // Walks the members of an object or the elements of an array.
+    class iterator {
+    private:
+        const compact_tree *tree;
+        size_t at;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = compact_value;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = compact_value;
+
+        iterator(const compact_tree *t = nullptr, size_t i = 0)
+            : tree(t), at(i) {}
+
+        compact_value operator*() const { return compact_value(tree, at); }
+
+        iterator &
+        operator++() {
+            at = tree->next(at);
+            return *this;
+        }
+
+        iterator
+        operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &o) const { return at == o.at; }
+        bool operator!=(const iterator &o) const { return at != o.at; }
+    };
+
+    valuetype
+    type() const {
+        return static_cast<valuetype>(tree->nodes[entry].type);
+    }
+
+    // The member name, empty for array elements and the top-level value.
+    std::string_view
+    name() const {
+        uint32_t key = tree->nodes[entry].key;
+        return key ? tree->names().name(key) : std::string_view();
+    }
+
+    bool
+    is_container() const {
+        valuetype t = type();
+        return t == TOP || t == OBJECT || t == ARRAY;
+    }
+
+    iterator
+    begin() const {
+        return iterator(tree, is_container() ? entry + 1 : entry);
+    }
+
+    iterator
+    end() const {
+        return iterator(tree, is_container() ? tree->next(entry) : entry);
+    }
+
+    size_t
+    size() const {
+        return is_container() ? tree->count(entry) : 0;
+    }
+
+    // The member named key, comparing name ids.
+    std::optional<compact_value>
+    find(std::string_view key) const {
+        if (type() != TOP && type() != OBJECT)
+            return std::nullopt;
+        uint32_t id = tree->names().find(key);
+        if (id == interned_key::absent)
+            return std::nullopt;
+        for (iterator i = begin(); i != end(); ++i) {
+            if (tree->nodes[(*i).entry].key == id)
+                return *i;
+        }
+        return std::nullopt;
+    }
+
+    compact_value
+    operator[](std::string_view key) const {
+        std::optional<compact_value> member = find(key);
+        if (!member)
+            throw std::out_of_range("No such key.\n");
+        return *member;
+    }
+
+    // The index-th member or element, walking from the first one.
+    compact_value
+    at(size_t index) const {
+        iterator i = begin();
+        for (; i != end() && index; --index)
+            ++i;
+        if (i == end())
+            throw std::out_of_range("No such index.\n");
+        return *i;
+    }
+
+    // The value as T, like jsonobj::get().
+    template <typename T>
+    T
+    get() const {
+        jsonobj n;
+        n.type = type();
+        switch (n.type) {
+        case STRING: {
+            n.obj = tree->get_string(entry);
+        } break;
+        case INTEGER: {
+            if (tree->nodes[entry].length)
+                n.obj = tree->get_uint64(entry);
+            else
+                n.obj = tree->get_int64(entry);
+        } break;
+        case FLOAT: {
+            n.obj = tree->get_double(entry);
+        } break;
+        case BOOLEAN: {
+            n.obj = tree->nodes[entry].payload != 0;
+        } break;
+        default:
+            break;
+        }
+        return n.get<T>();
+    }
+};
+
+inline compact_value
+compact_tree::root() const {
+    if (nodes.empty())
+        throw std::out_of_range("No such index.\n");
+    return compact_value(this, 0);
+}
+
+/**
+ * @brief What the reads and parses of a json_storage did, see
+ * json_storage::stats(). Only filled when SLOWJSON_STATS is defined.
+ * Counters add up across calls until reset, and operator+= sums those of
+ * several storages, keeping the deepest nesting.
+ */
+struct parse_stats {
+    enum phase {
+        PHASE_READ = 0,     // read(), read_view(), read_file()
+        PHASE_TOKENIZE = 1, // tokenize()
+        PHASE_PARSE = 2,    // Every parse_*() and parse(), feed(), finish()
+        PHASE_COUNT = 3,
+    };
+
+    uint64_t calls[PHASE_COUNT];
+    uint64_t nanoseconds[PHASE_COUNT];
+    uint64_t bytes[PHASE_COUNT]; // Of json text consumed
+
+    // Tokens of each valuetype, from LBRACE to JSONNULL, as the tokenizer
+    // produced them: by tokenize(), or by a parse that scans the text itself.
+    uint64_t tokens[JSONNULL + 1];
+
+    uint64_t nodes;     // Values parsed, not counting the top-level one
+    uint64_t max_depth; // Of nesting, 1 for the top-level object or array
+
+    // Chunks the storage's arenas took from upstream for nodes and strings.
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+
+    parse_stats() { clear(); }
+
+    void
+    clear() {
+        *this = parse_stats(nullptr);
+    }
+
+    parse_stats &
+    operator+=(const parse_stats &o) {
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            calls[p] += o.calls[p];
+            nanoseconds[p] += o.nanoseconds[p];
+            bytes[p] += o.bytes[p];
+        }
+        for (int t = 0; t <= JSONNULL; ++t)
+            tokens[t] += o.tokens[t];
+        nodes += o.nodes;
+        max_depth = std::max(max_depth, o.max_depth);
+        allocations += o.allocations;
+        allocated_bytes += o.allocated_bytes;
+        return *this;
+    }
+
+private:
+    explicit parse_stats(std::nullptr_t)
+        : calls(), nanoseconds(), bytes(), tokens(), nodes(0), max_depth(0),
+          allocations(0), allocated_bytes(0) {}
+};
+
+/**
+ * @brief The members of T that struct_decoder and encode() know about.
+ * Specialize it with SLOWJSON_BIND, or by hand with a static constexpr
+ * fields() returning a std::tuple of bind_field() results.
+ */
+template <typename T>
+struct json_binding {};
+
+template <typename T, typename M>
+struct bound_field {
+    std::string_view name; // The json key
+    M T::*member;
+};
+
+template <typename T, typename M>
+constexpr bound_field<T, M>
+bind_field(std::string_view name, M T::*member) {
+    return bound_field<T, M>{name, member};
+}
+
+template <typename T, typename = void>
+struct is_json_bound : std::false_type {};
+
+template <typename T>
+struct is_json_bound<T, std::void_t<decltype(json_binding<T>::fields())>>
+    : std::true_type {};
+
+template <typename T>
+struct is_json_vector : std::false_type {};
+
+template <typename T, typename A>
+struct is_json_vector<std::vector<T, A>> : std::true_type {};
+
+template <typename T>
+struct is_json_optional : std::false_type {};
+
+template <typename T>
+struct is_json_optional<std::optional<T>> : std::true_type {};
+
+// Seeded FNV-1a over a key, and the search for a seed under which every key
+// of a set gets a slot of its own, run by the compiler.
+struct perfect_hash {
+    static constexpr uint32_t
+    hash(std::string_view key, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char c : key) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    template <size_t Size>
+    struct table {
+        uint32_t seed;
+        std::array<uint8_t, Size> slots; // Key number, 0xFF when empty
+    };
+
+    template <size_t Size, size_t Count>
+    static constexpr table<Size>
+    build(const std::array<std::string_view, Count> &keys) {
+        for (uint32_t seed = 0;; ++seed) {
+            table<Size> t{seed, {}};
+            for (size_t s = 0; s < Size; ++s)
+                t.slots[s] = 0xFF;
+            bool distinct = true;
+            for (size_t i = 0; i < Count && distinct; ++i) {
+                uint8_t &s = t.slots[hash(keys[i], seed) & (Size - 1)];
+                distinct = s == 0xFF;
+                s = static_cast<uint8_t>(i);
+            }
+            if (distinct)
+                return t;
+        }
+    }
+
+    static constexpr size_t
+    table_size(size_t count) {
+        size_t size = 1;
+        while (size < 4 * count)
+            size *= 2;
+        return size;
+    }
+
+    // The json keys of a tuple of bound_field.
+    template <typename Fields, size_t... I>
+    static constexpr std::array<std::string_view, sizeof...(I)>
+    keys(const Fields &fields, std::index_sequence<I...>) {
+        return {{std::get<I>(fields).name...}};
+    }
+
+    template <size_t Count>
+    static constexpr bool
+    unique(const std::array<std::string_view, Count> &keys) {
+        for (size_t i = 0; i < Count; ++i) {
+            for (size_t j = i + 1; j < Count; ++j) {
+                if (keys[i] == keys[j])
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+// The bound members of T, and their number by json key.
+template <typename T>
+class field_index {
+public:
+    static constexpr auto fields = json_binding<T>::fields();
+    static constexpr size_t count =
+        std::tuple_size<std::remove_const_t<decltype(fields)>>::value;
+
+private:
+    static_assert(count < 0xFF, "Too many bound members");
+
+    static constexpr std::array<std::string_view, count> names =
+        perfect_hash::keys(fields, std::make_index_sequence<count>());
+    static_assert(perfect_hash::unique(names), "Bound keys must be unique");
+
+    static constexpr size_t size = perfect_hash::table_size(count);
+    static constexpr perfect_hash::table<size> table =
+        perfect_hash::build<size>(names);
+
+public:
+    // The number of the member with json key name, or count.
+    static size_t
+    find(std::string_view name) {
+        uint8_t i = table.slots[perfect_hash::hash(name, table.seed) &
+                                (size - 1)];
+        return i != 0xFF && names[i] == name ? i : count;
+    }
+};
+
+// Hand value to a handler of parsing events (see sax_handler): a bound
+// type as an object of its members, a std::vector as an array, an empty
+// std::optional as null. Returns false if the handler stopped.
+template <typename T, typename Handler>
+bool
+encode(const T &value, Handler &h) {
+    if constexpr (std::is_same_v<T, bool>) {
+        return h.boolean(value);
+    } else if constexpr (std::is_integral_v<T>) {
+        if constexpr (std::is_unsigned_v<T>) {
+            if (static_cast<uint64_t>(value) > INT64_MAX)
+                return h.uint64(value);
+        }
+        return h.int64(static_cast<int64_t>(value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return h.float64(static_cast<double>(value));
+    } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+        return h.string(std::string_view(value));
+    } else if constexpr (is_json_optional<T>::value) {
+        return value ? encode(*value, h) : h.null();
+    } else if constexpr (is_json_vector<T>::value) {
+        if (!h.start_array())
+            return false;
+        for (const auto &e : value) {
+            if (!encode(static_cast<const typename T::value_type &>(e), h))
+                return false;
+        }
+        return h.end_array();
+    } else {
+        static_assert(is_json_bound<T>::value,
+                      "Bind the type with SLOWJSON_BIND");
+        if (!h.start_object())
+            return false;
+        bool go = true;
+        std::apply(
+            [&](const auto &...f) {
+                ((go = go && h.key(f.name) && encode(value.*f.member, h)),
+                 ...);
+            },
+            field_index<T>::fields);
+        return go && h.end_object();
+    }
+}
+
+// value as json text, compact or indented by indent spaces.
+template <typename T>
+std::string
+to_json(const T &value, int indent = 0) {
+    std::string out;
+    json_writer w(out, indent);
+    encode(value, w);
+    return out;
+}
+
+/**
+ * @brief Parsing events into a bound type, see json_storage::parse_into().
+ * Values go straight into the members named by json_binding, found by a
+ * perfect hash of the key. Members may be bound types, std::vector,
+ * std::optional, std::string, bool or arithmetic. Unknown keys are skipped
+ * and absent members keep their value. A value of the wrong type, or a
+ * number out of the range of its member, throws.
+ */
+class struct_decoder {
+private:
+    struct slot;
+
+    // What a value does to its target; a null entry refuses that kind of
+    // value.
+    struct slot_ops {
+        void (*string)(void *, std::string_view);
+        void (*int64)(void *, int64_t);
+        void (*uint64)(void *, uint64_t);
+        void (*float64)(void *, double);
+        void (*boolean)(void *, bool);
+        void (*null)(void *);
+        slot (*member)(void *, std::string_view); // Of an object, by key
+        slot (*element)(void *);                  // Appended to an array
+        void (*start)(void *);                    // Before either
+        slot (*unwrap)(void *); // The value of an optional, emplaced
+    };
+
+    struct slot {
+        void *target;
+        const slot_ops *ops;
+    };
+
+    struct frame {
+        slot container;
+        bool array;
+    };
+
+    slot pending; // Where the next value of an object (or the root) goes
+    std::vector<frame> stack;
+
+    template <typename V>
+    static slot
+    slot_of(V &v) {
+        return slot{&v, &ops<V>()};
+    }
+
+    template <typename V>
+    static const slot_ops &
+    ops() {
+        static const slot_ops table = make_ops<V>();
+        return table;
+    }
+
+    // Takes every value and keeps none, for unknown keys.
+    static slot
+    skip() {
+        static const slot_ops table = {
+            [](void *, std::string_view) {},
+            [](void *, int64_t) {},
+            [](void *, uint64_t) {},
+            [](void *, double) {},
+            [](void *, bool) {},
+            [](void *) {},
+            [](void *, std::string_view) { return skip(); },
+            [](void *) { return skip(); },
+            nullptr,
+            nullptr};
+        return slot{nullptr, &table};
+    }
+
+    template <typename I, typename N>
+    static I
+    narrow(N n) {
+        bool fits = static_cast<uint64_t>(n) <=
+                    static_cast<uint64_t>(std::numeric_limits<I>::max());
+        if constexpr (std::is_signed_v<N>) {
+            if (n < 0)
+                fits = std::is_signed_v<I> &&
+                       n >= static_cast<int64_t>(std::numeric_limits<I>::min());
+        }
+        if (!fits)
+            throw std::runtime_error("Bad type.\n");
+        return static_cast<I>(n);
+    }
+
+    template <typename V, size_t I>
+    static slot
+    member_slot(void *t) {
+        return slot_of(static_cast<V *>(t)->*std::get<I>(
+                                                  field_index<V>::fields)
+                                                  .member);
+    }
+
+    template <typename V, size_t... I>
+    static slot
+    member_at(void *t, size_t i, std::index_sequence<I...>) {
+        static constexpr slot (*make[])(void *) = {&member_slot<V, I>...};
+        return make[i](t);
+    }
+
+    template <typename V>
+    static slot
+    member_of(void *t, std::string_view key) {
+        if constexpr (field_index<V>::count == 0) {
+            return skip();
+        } else {
+            size_t i = field_index<V>::find(key);
+            if (i == field_index<V>::count)
+                return skip();
+            return member_at<V>(
+                t, i, std::make_index_sequence<field_index<V>::count>());
+        }
+    }
+
+    template <typename V>
+    static slot_ops
+    make_ops() {
+        slot_ops o{};
+        if constexpr (std::is_same_v<V, bool>) {
+            o.boolean = [](void *t, bool b) { *static_cast<V *>(t) = b; };
+        } else if constexpr (std::is_integral_v<V>) {
+            o.int64 = [](void *t, int64_t i) {
+                *static_cast<V *>(t) = narrow<V>(i);
+            };
+            o.uint64 = [](void *t, uint64_t u) {
+                *static_cast<V *>(t) = narrow<V>(u);
+            };
+        } else if constexpr (std::is_floating_point_v<V>) {
+            o.int64 = [](void *t, int64_t i) {
+                *static_cast<V *>(t) = static_cast<V>(i);
+            };
+            o.uint64 = [](void *t, uint64_t u) {
+                *static_cast<V *>(t) = static_cast<V>(u);
+            };
+            o.float64 = [](void *t, double d) {
+                *static_cast<V *>(t) = static_cast<V>(d);
+            };
+        } else if constexpr (std::is_same_v<V, std::string>) {
+            o.string = [](void *t, std::string_view s) {
+                static_cast<V *>(t)->assign(s.data(), s.size());
+            };
+        } else if constexpr (is_json_optional<V>::value) {
+            o.null = [](void *t) { static_cast<V *>(t)->reset(); };
+            o.unwrap = [](void *t) {
+                return slot_of(static_cast<V *>(t)->emplace());
+            };
+        } else if constexpr (is_json_vector<V>::value) {
+            static_assert(!std::is_same_v<typename V::value_type, bool>,
+                          "std::vector<bool> cannot be decoded into");
+            o.start = [](void *t) { static_cast<V *>(t)->clear(); };
+            o.element = [](void *t) {
+                return slot_of(static_cast<V *>(t)->emplace_back());
+            };
+        } else {
+            static_assert(is_json_bound<V>::value,
+                          "Bind the type with SLOWJSON_BIND");
+            o.member = [](void *t, std::string_view key) {
+                return member_of<V>(t, key);
+            };
+        }
+        return o;
+    }
+
+    // The slot of the next value: the next element of an array, or the one
+    // named by the last key.
+    slot
+    take() {
+        if (!stack.empty() && stack.back().array) {
+            const slot &c = stack.back().container;
+            return c.ops->element(c.target);
+        }
+        return pending;
+    }
+
+    template <typename Op, typename... V>
+    bool
+    value(Op slot_ops::*op, V... v) {
+        slot s = take();
+        while (!(s.ops->*op) && s.ops->unwrap)
+            s = s.ops->unwrap(s.target);
+        if (!(s.ops->*op))
+            throw std::runtime_error("Bad type.\n");
+        (s.ops->*op)(s.target, v...);
+        return true;
+    }
+
+    bool
+    open(bool array) {
+        slot s = take();
+        auto accepts = [array](const slot &s) {
+            return array ? s.ops->element != nullptr : s.ops->member != nullptr;
+        };
+        while (!accepts(s) && s.ops->unwrap)
+            s = s.ops->unwrap(s.target);
+        if (!accepts(s))
+            throw std::runtime_error("Bad type.\n");
+        if (s.ops->start)
+            s.ops->start(s.target);
+        stack.push_back(frame{s, array});
+        return true;
+    }
+
+public:
+    template <typename T>
+    explicit struct_decoder(T &out) : pending(slot_of(out)) {}
+
+    bool start_object() { return open(false); }
+    bool start_array() { return open(true); }
+
+    bool
+    end_object() {
+        stack.pop_back();
+        return true;
+    }
+
+    bool
+    end_array() {
+        stack.pop_back();
+        return true;
+    }
+
+    bool
+    key(std::string_view name) {
+        const slot &c = stack.back().container;
+        pending = c.ops->member(c.target, name);
+        return true;
+    }
+
+    bool string(std::string_view s) { return value(&slot_ops::string, s); }
+    bool int64(int64_t i) { return value(&slot_ops::int64, i); }
+    bool uint64(uint64_t u) { return value(&slot_ops::uint64, u); }
+    bool float64(double d) { return value(&slot_ops::float64, d); }
+    bool boolean(bool b) { return value(&slot_ops::boolean, b); }
+    bool null() { return value(&slot_ops::null); }
+};
+
+/**
+ * @brief Layout of the binary snapshots of json_storage::save_snapshot().
+ * A header, the nodes of the tree in document order (a node's first child
+ * right after it), then a pool of strings, each a 32-bit length and its
+ * bytes. Nodes refer to each other by index and to strings by offset into
+ * the pool, so a snapshot can be used wherever it is mapped. Member names
+ * are pooled once each. Numbers are in the byte order of the machine that
+ * saved it; a snapshot from another byte order or version is refused.
+ */
+struct snapshot_format {
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t byte_order = 0x01020304;
+    static constexpr uint32_t none = UINT32_MAX; // No name, child or sibling
+
+    struct header {
+        char magic[8]; // "SLOWJSON"
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t source; // fingerprint() of the json text
+        uint64_t node_count;
+        uint64_t strings_size;
+        uint64_t checksum; // hash() of everything after the header
+    };
+
+    struct node {
+        uint8_t type;
+        uint8_t is_unsigned; // INTEGER holding an uint64_t
+        uint16_t reserved;
+        uint32_t name;  // Offset into the pool
+        uint32_t next;  // Index of the next sibling
+        uint32_t child; // Index of the first child
+        uint64_t value; // Number bits, boolean, or offset of a string
+    };
+
+    static_assert(sizeof(header) == 48 && sizeof(node) == 24,
+                  "snapshot layout");
+
+    // 64-bit hash of bytes, four words at a time (the rounds of xxHash64).
+    // Only good against accidents, not against forgery.
+    static uint64_t
+    hash(std::string_view bytes, uint64_t seed = 0) {
+        const uint64_t p1 = 0x9E3779B185EBCA87ULL;
+        const uint64_t p2 = 0xC2B2AE3D27D4EB4FULL;
+        auto round = [&](uint64_t acc, uint64_t word) {
+            acc += word * p2;
+            acc = (acc << 31) | (acc >> 33);
+            return acc * p1;
+        };
+        const char *p = bytes.data();
+        size_t n = bytes.size();
+        uint64_t lane[4] = {seed + p1 + p2, seed + p2, seed, seed - p1};
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            for (int k = 0; k < 4; ++k) {
+                uint64_t word;
+                memcpy(&word, p + i + 8 * k, sizeof(word));
+                lane[k] = round(lane[k], word);
+            }
+        }
+        uint64_t h = n;
+        for (int k = 0; k < 4; ++k)
+            h = round(h ^ lane[k], lane[(k + 1) % 4]);
+        for (; i + 8 <= n; i += 8) {
+            uint64_t word;
+            memcpy(&word, p + i, sizeof(word));
+            h = round(h, word);
+        }
+        for (; i < n; ++i)
+            h = round(h, static_cast<unsigned char>(p[i]));
+        // Final mix of MurmurHash3.
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // What a snapshot records of the json text it was saved from.
+    static uint64_t
+    fingerprint(std::string_view text) {
+        return hash(text, version);
+    }
+};
+
+class lazy_value;
+class path_query;
+class thread_pool;
+
+class json_storage {
+private:
+    friend class lazy_value;
+
+    // Owns every node below parsed_obj. Held by pointer so its address, which
+    // the node strings keep, survives moving the storage.
+    std::unique_ptr<arena> nodes;
+
+    // Nodes made by the threads of parse_parallel(), one arena per thread.
+    std::vector<std::unique_ptr<arena>> thread_nodes;
+
+    // Backs the tokens in token_stream that are not plain views into
+    // the material (unescaped strings).
+    std::unique_ptr<arena> token_strings;
+
+    jsonobj parsed_obj;
+
+    std::string json_material;
+
+#ifdef SLOWJSON_HAS_MMAP
+    mapped_file mapping;
+#endif
+
+    // The text being parsed: json_material, or the mapping when the input
+    // came from a file that could be mapped.
+    std::string_view material;
+
+    std::vector<Token> token_stream;
+
+    structural_index structural;
+
+    // Reused by tokenize() and the one-pass parses, and lent to the
+    // dom_builder of parsed_obj, so they keep their capacity (see reset()).
+    tokenizer scanner;
+    std::vector<jsonobj *> spare_parents;
+    std::vector<size_t> spare_members;
+
+    // Kept for validate(), so its buffers are reused.
+    json_validator validator;
+
+    integer_overflow overflow_policy;
+
+    // Numbers of the tree are kept as text until read.
+    bool lazy_numbers;
+
+    // Parsing state carried between feed() calls.
+    struct stream_state;
+    std::unique_ptr<stream_state> stream;
+
+    // Objects with at least this many members get a member_index.
+    size_t index_threshold;
+
+    // Member names are interned here when set.
+    std::shared_ptr<key_pool> keys;
+
+    // Strings of parse_lazy() that needed unescaping, by entry, so each is
+    // decoded into the node arena once however often it is read.
+    std::unordered_map<uint32_t, std::string_view> lazy_strings;
+
+#ifdef SLOWJSON_STATS
+    parse_stats counters;
+
+    // Adds the time, bytes and arena chunks of one call to counters when it
+    // goes out of scope. bytes defaults to the size of the material then.
+    class stats_scope {
+    private:
+        json_storage &js;
+        parse_stats::phase phase;
+        size_t bytes;
+        std::chrono::steady_clock::time_point start;
+        size_t allocations;
+        size_t allocated_bytes;
+
+    public:
+        stats_scope(json_storage &s, parse_stats::phase p,
+                    size_t b = SIZE_MAX)
+            : js(s), phase(p), bytes(b),
+              start(std::chrono::steady_clock::now()) {
+            js.arena_totals(allocations, allocated_bytes);
+        }
+
+        ~stats_scope() {
+            std::chrono::nanoseconds took =
+                std::chrono::steady_clock::now() - start;
+            size_t a, b;
+            js.arena_totals(a, b);
+            parse_stats &c = js.counters;
+            ++c.calls[phase];
+            c.nanoseconds[phase] += took.count();
+            c.bytes[phase] += bytes == SIZE_MAX ? js.material.size() : bytes;
+            c.allocations += a - allocations;
+            c.allocated_bytes += b - allocated_bytes;
+        }
+    };
+
+    void
+    arena_totals(size_t &allocations, size_t &bytes) const {
+        allocations = nodes->allocations() + token_strings->allocations();
+        bytes = nodes->allocated_bytes() + token_strings->allocated_bytes();
+        for (const auto &a : thread_nodes) {
+            allocations += a->allocations();
+            bytes += a->allocated_bytes();
+        }
+    }
+#else
+    struct stats_scope {
+        stats_scope(json_storage &, parse_stats::phase, size_t = 0) {}
+    };
+#endif
+
+public:
+    json_storage() : json_storage(std::pmr::get_default_resource()) {}
+
+    // Nodes are carved out of chunks requested from upstream.
+    explicit json_storage(std::pmr::memory_resource *upstream)
+        : nodes(std::make_unique<arena>(upstream)),
+          token_strings(std::make_unique<arena>(upstream)),
+          overflow_policy(OVERFLOW_UNSIGNED_OR_FLOAT), lazy_numbers(false),
+          index_threshold(16) {
+        parsed_obj.child = nullptr;
+        parsed_obj.next = nullptr;
+    }
+
+    json_storage(json_storage &&) = default;
+    json_storage &operator=(json_storage &&) = default;
+
+    void
+    set_integer_overflow(integer_overflow policy) {
+        overflow_policy = policy;
+    }
+
+    // Make the following parses into the tree keep every number as its
+    // text (see lazy_number), converting it when it is first read:
+    // parsing skips the conversions of the numbers never read, and
+    // jsonobj::number_text() gives the exact text of any of them. Tapes,
+    // compact trees, bound types and SAX handlers still get converted
+    // numbers.
+    void
+    set_lazy_numbers(bool on) {
+        lazy_numbers = on;
+    }
+
+    // Objects with at least count members are hashed by name when parsed,
+    // making find() and operator[] O(1) on them. 0 turns this off.
+    void
+    set_index_threshold(size_t count) {
+        index_threshold = count;
+    }
+
+    // Intern the member names of the following parses into pool, which can
+    // be shared with other storages parsed on the same thread. nullptr turns
+    // interning off.
+    void
+    set_key_pool(std::shared_ptr<key_pool> pool) {
+        keys = std::move(pool);
+    }
+
+    // name as looked up in the key pool, for find() and operator[] by id.
+    interned_key
+    key(std::string_view name) const {
+        return interned_key{keys.get(), keys ? keys->find(name) : 0, name};
+    }
+
+    // What reads and parses did since the storage was made or reset_stats()
+    // was called. Always zero unless SLOWJSON_STATS is defined.
+    const parse_stats &
+    stats() const {
+#ifdef SLOWJSON_STATS
+        return counters;
+#else
+        static const parse_stats none;
+        return none;
+#endif
+    }
+
+    void
+    reset_stats() {
+#ifdef SLOWJSON_STATS
+        counters.clear();
+#endif
+    }
+
+    // The top-level object of the last parse.
+    const jsonobj &
+    root() const {
+        return parsed_obj;
+    }
+
+    // Drop tokens, they point into the material being replaced.
+    void
+    clear_tokens() {
+        token_stream.clear();
+        token_strings->reset();
+    }
+
+    // Drop the parsed tree, and any feed() building it. The chunks of its
+    // nodes are kept for the next parse.
+    void
+    clear() {
+        stream.reset();
+        parsed_obj.child = nullptr;
+        parsed_obj.next = nullptr;
+        parsed_obj.type = JSONNULL;
+        parsed_obj.obj = int64_t(0);
+        nodes->reset();
+        for (auto &a : thread_nodes)
+            a->reset();
+        lazy_strings.clear();
+    }
+
+    // Drop the document: material, tokens and tree. Every buffer keeps its
+    // capacity, the material's own copy, the tokens, the stacks of the
+    // parsing machine and the chunks of the nodes, so once a storage has
+    // seen a document as big as the next one, reading that one with
+    // read(data, size) or read_view() and running tokenize(), parse() or
+    // parse_direct() on it allocates nothing. (Reading a std::string takes
+    // over its buffer instead.)
+    void
+    reset() {
+        release_material();
+    }
+
+    // Give back the memory that reset() and clear() keep.
+    void
+    shrink_to_fit() {
+        reset();
+        nodes->release();
+        token_strings->release();
+        thread_nodes.clear();
+        json_material.shrink_to_fit();
+        token_stream.shrink_to_fit();
+        structural.positions.shrink_to_fit();
+        scanner = tokenizer();
+        context = parse_context();
+        spare_parents.shrink_to_fit();
+        spare_members.shrink_to_fit();
+    }
+
+    void
+    read(std::string material) {
+        stats_scope scope(*this, parse_stats::PHASE_READ);
+        release_material();
+        json_material = std::move(material);
+        use_json_material();
+    }
+
+    // Copy text into the storage's own buffer, which keeps its capacity
+    // from one document to the next.
+    void
+    read(const char *data, size_t size) {
+        stats_scope scope(*this, parse_stats::PHASE_READ);
+        release_material();
+        json_material.assign(data, size);
+        use_json_material();
+    }
+
+    // Parse text where it is, without a copy. It must outlive the tokens
+    // and the tree.
+    void
+    read_view(std::string_view text) {
+        stats_scope scope(*this, parse_stats::PHASE_READ);
+        release_material();
+        material = text;
+    }
+
+    void
+    read(std::fstream &material) {
+        if (!material.is_open())
+            throw std::runtime_error("bad fstream");
+        stats_scope scope(*this, parse_stats::PHASE_READ);
+        release_material();
+        material.seekg(0, std::ios::end);
+        std::streamoff size = material.tellg();
+        material.seekg(0, std::ios::beg);
+        if (size >= 0) {
+            json_material.resize(size);
+            material.read(&json_material[0], size);
+            json_material.resize(material.gcount());
+        } else {
+            material.clear();
+            json_material.assign(std::istreambuf_iterator<char>(material),
+                                 std::istreambuf_iterator<char>());
+        }
+        use_json_material();
+    }
+
+#ifdef SLOWJSON_HAS_MMAP
+    // Read from a file descriptor. Regular files are mapped and parsed in
+    // place; anything that cannot be mapped (pipes, sockets) is read in bulk.
+    // The descriptor can be closed afterwards.
+    void
+    read(int fd) {
+        stats_scope scope(*this, parse_stats::PHASE_READ);
+        release_material();
+        if (mapping.map(fd)) {
+            material = mapping.view();
+            return;
+        }
+        struct stat st;
+        size_t capacity = 65536;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+            capacity = st.st_size;
+        size_t used = 0;
+        json_material.resize(capacity);
+        while (1) {
+            if (used == json_material.size())
+                json_material.resize(used * 2);
+            ssize_t n =
+                ::read(fd, &json_material[used], json_material.size() - used);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("bad fd");
+            }
+            if (n == 0)
+                break;
+            used += n;
+        }
+        json_material.resize(used);
+        use_json_material();
+    }
+
+    void
+    read_file(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("bad file");
+        try {
+            read(fd);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+    }
+#else
+    void
+    read_file(const std::string &path) {
+        std::fstream f(path, std::ios::in | std::ios::binary);
+        if (!f.is_open())
+            throw std::runtime_error("bad file");
+        read(f);
+    }
+#endif
+
+    void
+    read_token_stream() {
+        for (auto &v : token_stream) {
+            switch (v.token_type) {
+            case LBRACE:
+                std::cout << "LBRACE";
+                break;
+            case RBRACE:
+                std::cout << "RBRACE";
+                break;
+            case LBRACKET:
+                std::cout << "LBRACKET";
+                break;
+            case RBRACKET:
+                std::cout << "RBRACKET";
+                break;
+            case COMMA:
+                std::cout << "COMMA";
+                break;
+            case COLON:
+                std::cout << "COLON";
+                break;
+            case FLOAT:
+                std::cout << "FLOAT";
+                break;
+            case INTEGER:
+                std::cout << "INTEGER";
+                break;
+            case STRING:
+                std::cout << "STRING";
+                break;
+            case BOOLEAN:
+                std::cout << "BOOLEAN";
+                break;
+            case JSONNULL:
+                std::cout << "JSONNULL";
+                break;
+            default:
+                throw std::runtime_error("Unexpected token tokenized.\n");
+            }
+            std::cout << ' ';
+        }
+    }
+
+    // tokenize text. First step of processing raw json text.
+    void
+    tokenize() {
+        stats_scope scope(*this, parse_stats::PHASE_TOKENIZE);
+        clear_tokens();
+        tokenizer &t = scanner;
+        t.reset();
+        auto emit = [this](valuetype type, std::string_view value) {
+            token_stream.push_back(Token(keep(value, *token_strings), type));
+#ifdef SLOWJSON_STATS
+            ++counters.tokens[type];
+#endif
+            return true;
+        };
+        const char *first = material.data();
+        const char *last = first + material.size();
+        if (use_index())
+            t.scan_indexed(first, last, structural.positions, emit);
+        else
+            t.scan(first, last, emit);
+        t.finish(emit);
+    }
+
+private:
+    // On-demand access (see lazy_value) works on the structural index of
+    // the material, entry by entry.
+    char
+    lazy_char(uint32_t e) const {
+        if (e >= structural.positions.size())
+            throw std::runtime_error("Bad Json: Unexpected end.\n");
+        return material[structural.positions[e]];
+    }
+
+    // The entry after the value starting at entry e. Objects and arrays are
+    // skipped whole by balancing brackets, without decoding anything
+    // inside.
+    uint32_t
+    lazy_skip(uint32_t e) const {
+        char c = lazy_char(e);
+        if (c == '"')
+            return e + 2;
+        if (c != '{' && c != '[')
+            return e + 1;
+        std::string check(1, c);
+        while (!check.empty()) {
+            c = lazy_char(++e);
+            if (c == '{' || c == '[') {
+                check.push_back(c);
+            } else if (c == '}' || c == ']') {
+                if (check.back() != (c == '}' ? '{' : '['))
+                    throw std::runtime_error("Bad Json: Bad brackets.\n");
+                check.pop_back();
+            }
+        }
+        return e + 1;
+    }
+
+    // The bytes between the quotes of the string at entry e, when they need
+    // no unescaping.
+    bool
+    lazy_raw_string(uint32_t e, std::string_view &raw) const {
+        if (lazy_char(e) != '"' || lazy_char(e + 1) != '"')
+            return false;
+        size_t first = structural.positions[e] + 1;
+        raw = material.substr(first, structural.positions[e + 1] - first);
+        return raw.find('\\') == std::string_view::npos;
+    }
+
+    // Decode the scalar starting at entry e into n. Unescaped strings go to
+    // the node arena, once.
+    void
+    lazy_decode(uint32_t e, jsonobj &n) {
+        struct number_sink : sax_handler {
+            jsonobj &n;
+            explicit number_sink(jsonobj &o) : n(o) {}
+            bool
+            int64(int64_t i) {
+                n.type = INTEGER;
+                n.obj = i;
+                return true;
+            }
+            bool
+            uint64(uint64_t u) {
+                n.type = INTEGER;
+                n.obj = u;
+                return true;
+            }
+            bool
+            float64(double d) {
+                n.type = FLOAT;
+                n.obj = d;
+                return true;
+            }
+        };
+        auto cached = lazy_strings.find(e);
+        if (cached != lazy_strings.end()) {
+            n.type = STRING;
+            n.obj = cached->second;
+            return;
+        }
+        const char *first = material.data() + structural.positions[e];
+        const char *last = material.data() + material.size();
+        if (*first == '"' && lazy_char(e + 1) == '"')
+            last = material.data() + structural.positions[e + 1] + 1;
+        else if (e + 1 < structural.positions.size())
+            last = material.data() + structural.positions[e + 1];
+        tokenizer t;
+        bool got = false;
+        valuetype type = JSONNULL;
+        std::string_view value;
+        auto emit = [&](valuetype ty, std::string_view v) {
+            got = true;
+            type = ty;
+            value = v;
+            return false;
+        };
+        if (t.scan(first, last, emit))
+            t.finish(emit);
+        if (!got)
+            throw std::runtime_error("Bad Json: Unexpected end.\n");
+        number_sink sink(n);
+        switch (type) {
+        case FLOAT:
+        case INTEGER: {
+            number_value(sink, type, value);
+        } break;
+        case STRING: {
+            std::string_view kept = keep(value, *nodes);
+            if (kept.data() != value.data())
+                lazy_strings.emplace(e, kept);
+            n.type = STRING;
+            n.obj = kept;
+        } break;
+        case BOOLEAN: {
+            n.type = BOOLEAN;
+            n.obj = value == "true";
+        } break;
+        case JSONNULL: {
+            n.type = JSONNULL;
+        } break;
+        default:
+            throw std::runtime_error("Bad Json: Illegal value.\n");
+        }
+    }
+
+public:
+    // Write parsed_obj as json text, compact or indented by indent spaces.
+    std::string
+    dump(int indent = 0) const {
+        std::string out;
+        dump_to(out, indent);
+        return out;
+    }
+
+    // Append parsed_obj as json text to out.
+    void
+    dump_to(std::string &out, int indent = 0) const {
+        json_writer w(out, indent);
+        parsed_obj.walk(w);
+    }
+
+#ifdef SLOWJSON_HAS_MMAP
+    // Write parsed_obj as json text to fd, a chunk at a time.
+    void
+    dump_to(int fd, int indent = 0) const {
+        json_writer w(fd, indent);
+        parsed_obj.walk(w);
+        w.flush();
+    }
+#endif
+
+    // parse the material on the threads of pool, generating parsed_obj. The
+    // body of the top-level object or array is split at top-level commas,
+    // so this pays off for big documents with many top-level members or
+    // elements; anything under 1 MiB is parsed by parse_direct(). The
+    // upstream resource of the storage must be thread-safe.
+    void
+    parse_parallel(thread_pool &pool);
+
+    // Index the material for on-demand access (see lazy_value) and return
+    // its top-level object. Nothing is decoded yet.
+    lazy_value
+    parse_lazy();
+
+    // Index the material like parse_lazy() and pick the values at the
+    // paths of q, one list per path in the order q numbered them. Only the
+    // matching values are decoded when read; the rest is skipped.
+    std::vector<std::vector<lazy_value>>
+    query(const path_query &q);
+
+    // Check that the material is json, grammar and UTF-8, without making
+    // tokens or nodes; see json_validator for the rules. Much cheaper than
+    // a parse when only the answer is needed, and it tells where the first
+    // error is.
+    validation_result
+    validate(simd_level level = SIMD_BEST) {
+        return validator.validate(material, level);
+    }
+
+private:
+    typedef std::stack<valuetype, std::vector<valuetype>> status_stack;
+
+    /**
+     * @brief State of the parsing status machine.
+     * Kept outside of parse() so that the machine can be fed one token at a
+     * time, either from token_stream or straight from the tokenizer. What is
+     * done with the tokens is up to the handler handed to parse_token().
+     */
+    struct parse_context {
+        status_stack machine_status;
+        bool stopped; // The handler asked to stop
+#ifdef SLOWJSON_STATS
+        uint64_t tokens[JSONNULL + 1] = {};
+        uint64_t depth = 0;
+        uint64_t max_depth = 0;
+
+        void
+        count(valuetype type) {
+            ++tokens[type];
+            if (type == LBRACE || type == LBRACKET)
+                max_depth = std::max(max_depth, ++depth);
+            else if (type == RBRACE || type == RBRACKET)
+                --depth;
+        }
+#endif
+
+        parse_context() : stopped(false) { machine_status.push(PARSE_INIT); }
+
+        // Ready for another text; the stack keeps its capacity.
+        void
+        reset() {
+            while (!machine_status.empty())
+                machine_status.pop();
+            machine_status.push(PARSE_INIT);
+            stopped = false;
+#ifdef SLOWJSON_STATS
+            std::fill(std::begin(tokens), std::end(tokens), 0);
+            depth = max_depth = 0;
+#endif
+        }
+    };
+
+    // The context of tokenize() and the one-pass parses, reset each time.
+    parse_context context;
+
+#ifdef SLOWJSON_STATS
+    // Fold the counts of a finished parse into counters; tokens only when
+    // the parse read them from the text rather than from token_stream.
+    void
+    count_parse(const parse_context &ctx, bool tokens) {
+        uint64_t values = 0;
+        for (valuetype t : {LBRACE, LBRACKET, STRING, INTEGER, FLOAT, BOOLEAN,
+                            JSONNULL})
+            values += ctx.tokens[t];
+        values -= ctx.tokens[COLON]; // Strings that were member names
+        counters.nodes += values ? values - 1 : 0;
+        counters.max_depth = std::max(counters.max_depth, ctx.max_depth);
+        if (tokens) {
+            for (int t = 0; t <= JSONNULL; ++t)
+                counters.tokens[t] += ctx.tokens[t];
+        }
+    }
+#endif
+
+    // Builds the jsonobj tree below parsed_obj, or below another root with
+    // nodes from another arena.
+    struct dom_builder {
+        json_storage &js;
+        arena &where;
+        jsonobj &root;
+        jsonobj **slot; // Where the next node will be linked
+        std::vector<jsonobj *> parse_stack;
+        std::vector<size_t> member_count; // Of each node on parse_stack
+        std::string_view name_tmp;
+        uint32_t key_tmp;
+        key_pool *keys; // Where names are interned, if anywhere
+        bool lent;      // The stacks are those of the storage
+
+        // The tree of the storage itself. The stacks are lent by the
+        // storage for the parse, so their capacity is kept from one
+        // document to the next.
+        explicit dom_builder(json_storage &s)
+            : dom_builder(s, *s.nodes, s.parsed_obj) {
+            parse_stack.swap(s.spare_parents);
+            member_count.swap(s.spare_members);
+            lent = true;
+        }
+
+        dom_builder(json_storage &s, arena &a, jsonobj &r)
+            : js(s), where(a), root(r), slot(&r.child), key_tmp(0),
+              keys(s.keys.get()), lent(false) {}
+
+        dom_builder(const dom_builder &) = delete;
+        dom_builder &operator=(const dom_builder &) = delete;
+
+        ~dom_builder() {
+            if (!lent)
+                return;
+            parse_stack.clear();
+            member_count.clear();
+            parse_stack.swap(js.spare_parents);
+            member_count.swap(js.spare_members);
+        }
+
+        // Allocate a node from the arena, named after the pending key, and
+        // link it where the previous sibling (or the parent, for a first
+        // child) expects it.
+        jsonobj *
+        node(valuetype type) {
+            jsonobj *p = new (where.allocate(sizeof(jsonobj),
+                                             alignof(jsonobj))) jsonobj();
+            p->type = type;
+            p->name = name_tmp;
+            p->key = key_tmp;
+            name_tmp = std::string_view();
+            key_tmp = 0;
+            *slot = p;
+            slot = &p->next;
+            if (!member_count.empty())
+                ++member_count.back();
+            return p;
+        }
+
+        // The top-level object (TOP) or array is the root itself.
+        bool
+        start(valuetype type) {
+            jsonobj *p = parse_stack.empty() ? &root : node(type);
+            if (parse_stack.empty())
+                p->type = type == OBJECT ? TOP : ARRAY;
+            parse_stack.push_back(p);
+            member_count.push_back(0);
+            slot = &p->child;
+            return true;
+        }
+
+        bool
+        end(valuetype type) {
+            jsonobj *p = parse_stack.back();
+            parse_stack.pop_back();
+            if (type == OBJECT && js.index_threshold &&
+                member_count.back() >= js.index_threshold)
+                p->obj = js.index_members(p->child, member_count.back(),
+                                          where);
+            member_count.pop_back();
+            slot = &p->next;
+            return true;
+        }
+
+        bool start_object() { return start(OBJECT); }
+        bool end_object() { return end(OBJECT); }
+        bool start_array() { return start(ARRAY); }
+        bool end_array() { return end(ARRAY); }
+
+        bool
+        key(std::string_view name) {
+            if (keys) {
+                key_tmp = keys->intern(name);
+                name_tmp = keys->name(key_tmp);
+            } else {
+                name_tmp = js.keep(name, where);
+            }
+            return true;
+        }
+
+        bool
+        string(std::string_view s) {
+            node(STRING)->obj = js.keep(s, where);
+            return true;
+        }
+
+        bool
+        int64(int64_t i) {
+            node(INTEGER)->obj = i;
+            return true;
+        }
+
+        bool
+        uint64(uint64_t u) {
+            node(INTEGER)->obj = u;
+            return true;
+        }
+
+        bool
+        float64(double d) {
+            node(FLOAT)->obj = d;
+            return true;
+        }
+
+        // A lazy number, next to its node.
+        bool
+        number(valuetype type, std::string_view text, bool is_unsigned) {
+            lazy_number *n = new (where.allocate(
+                sizeof(lazy_number), alignof(lazy_number))) lazy_number();
+            n->text = js.keep(text, where);
+            n->is_unsigned = is_unsigned;
+            n->state.store(lazy_number::unconverted,
+                           std::memory_order_relaxed);
+            node(type)->obj = n;
+            return true;
+        }
+
+        bool
+        boolean(bool b) {
+            node(BOOLEAN)->obj = b;
+            return true;
+        }
+
+        bool
+        null() {
+            node(JSONNULL);
+            return true;
+        }
+    };
+
+    // Appends to a json_tape.
+    struct tape_builder {
+        json_tape &tape;
+
+        bool
+        start_object() {
+            tape.open(OBJECT);
+            return true;
+        }
+
+        bool
+        end_object() {
+            tape.close();
+            return true;
+        }
+
+        bool
+        start_array() {
+            tape.open(ARRAY);
+            return true;
+        }
+
+        bool
+        end_array() {
+            tape.close();
+            return true;
+        }
+
+        bool
+        key(std::string_view name) {
+            tape.append_key(name);
+            return true;
+        }
+
+        bool
+        string(std::string_view s) {
+            tape.append_string(s);
+            return true;
+        }
+
+        bool
+        int64(int64_t i) {
+            tape.append_int64(i);
+            return true;
+        }
+
+        bool
+        uint64(uint64_t u) {
+            tape.append_uint64(u);
+            return true;
+        }
+
+        bool
+        float64(double d) {
+            tape.append_double(d);
+            return true;
+        }
+
+        bool
+        boolean(bool b) {
+            tape.append_bool(b);
+            return true;
+        }
+
+        bool
+        null() {
+            tape.append_null();
+            return true;
+        }
+    };
+
+    // Everything parsed from the old material goes with it.
+    void
+    release_material() {
+        clear();
+        clear_tokens();
+        json_material.clear();
+#ifdef SLOWJSON_HAS_MMAP
+        mapping.unmap();
+#endif
+        material = std::string_view();
+    }
+
+    // Tokens and nodes keep views into json_material. Keeping its bytes out
+    // of the small string buffer makes sure moving the storage does not move
+    // them.
+    void
+    use_json_material() {
+        json_material.reserve(2 * sizeof(std::string));
+        material = json_material;
+    }
+
+    // Views into the material stay valid as long as the storage holds it;
+    // anything else (unescaped strings) is copied into the given arena.
+    std::string_view
+    keep(std::string_view v, arena &where) {
+        std::less_equal<const char *> le;
+        const char *begin = material.data();
+        const char *end = begin + material.size();
+        if (v.empty() || (le(begin, v.data()) && le(v.data() + v.size(), end)))
+            return v;
+        char *copy = static_cast<char *>(where.allocate(v.size(), 1));
+        memcpy(copy, v.data(), v.size());
+        return std::string_view(copy, v.size());
+    }
+
+    // Hash the count members starting at first into a table at most half
+    // full.
+    const member_index *
+    index_members(const jsonobj *first, size_t count, arena &where) {
+        size_t capacity = 2;
+        while (capacity < 2 * count)
+            capacity *= 2;
+        const jsonobj **slots = static_cast<const jsonobj **>(
+            where.allocate(capacity * sizeof(jsonobj *), alignof(jsonobj *)));
+        std::fill(slots, slots + capacity, nullptr);
+        member_index *index = new (
+            where.allocate(sizeof(member_index), alignof(member_index)))
+            member_index{capacity - 1, slots};
+        std::hash<std::string_view> hash;
+        for (const jsonobj *c = first; c; c = c->next) {
+            size_t i = hash(c->name) & index->mask;
+            while (slots[i] && slots[i]->name != c->name)
+                i = (i + 1) & index->mask;
+            if (!slots[i])
+                slots[i] = c;
+        }
+        return index;
+    }
+
+    // Whether image is a whole snapshot of this version and byte order,
+    // saved from the json text with fingerprint source.
+    static bool
+    snapshot_usable(std::string_view image, uint64_t source) {
+        snapshot_format::header h;
+        if (image.size() < sizeof(h))
+            return false;
+        memcpy(&h, image.data(), sizeof(h));
+        size_t body = image.size() - sizeof(h);
+        return memcmp(h.magic, "SLOWJSON", sizeof(h.magic)) == 0 &&
+               h.version == snapshot_format::version &&
+               h.byte_order == snapshot_format::byte_order &&
+               h.source == source && h.node_count >= 1 &&
+               h.node_count < snapshot_format::none &&
+               h.node_count <= body / sizeof(snapshot_format::node) &&
+               h.node_count * sizeof(snapshot_format::node) +
+                       h.strings_size ==
+                   body &&
+               h.checksum == snapshot_format::hash(image.substr(sizeof(h)));
+    }
+
+    // Make parsed_obj over a usable snapshot, which must outlive it. Links
+    // only go forward, so a snapshot that passed the checksum but is
+    // malformed anyway is caught here, and throws.
+    void
+    build_from_snapshot(std::string_view image) {
+        typedef snapshot_format::node node;
+        snapshot_format::header h;
+        memcpy(&h, image.data(), sizeof(h));
+        const char *list = image.data() + sizeof(h);
+        std::string_view pool = image.substr(sizeof(h) + h.node_count *
+                                                             sizeof(node));
+        size_t count = h.node_count;
+        // parsed_obj is the first node, the others come in blocks that fill
+        // a chunk of the arena each. (A single block would be mapped fresh
+        // from the system, and faulted in page by page, at every load.)
+        const size_t per_block =
+            (arena::max_chunk_size - 256) / sizeof(jsonobj);
+        std::vector<jsonobj *> blocks((count - 1 + per_block - 1) / per_block);
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            size_t n = std::min(per_block, count - 1 - b * per_block);
+            blocks[b] = static_cast<jsonobj *>(
+                nodes->allocate(n * sizeof(jsonobj), alignof(jsonobj)));
+        }
+        auto at = [&](size_t i) -> jsonobj & {
+            return i ? blocks[(i - 1) / per_block][(i - 1) % per_block]
+                     : parsed_obj;
+        };
+        auto bad = [this]() {
+            clear();
+            return std::runtime_error("Bad snapshot.\n");
+        };
+        auto string_at = [&](uint64_t offset) {
+            uint32_t length;
+            if (offset > pool.size() || pool.size() - offset < sizeof(length))
+                throw bad();
+            memcpy(&length, pool.data() + offset, sizeof(length));
+            if (pool.size() - offset - sizeof(length) < length)
+                throw bad();
+            return pool.substr(offset + sizeof(length), length);
+        };
+        auto link = [&](size_t from, uint32_t to, bool child) -> jsonobj * {
+            if (to == snapshot_format::none)
+                return nullptr;
+            if (to <= from || to >= count || (child && to != from + 1))
+                throw bad();
+            return &at(to);
+        };
+        for (size_t i = 0; i < count; ++i) {
+            node n;
+            memcpy(&n, list + i * sizeof(node), sizeof(node));
+            jsonobj &o = i ? *new (&at(i)) jsonobj() : parsed_obj;
+            o.type = static_cast<valuetype>(n.type);
+            o.next = link(i, n.next, false);
+            o.child = link(i, n.child, true);
+            if (n.name != snapshot_format::none) {
+                o.name = string_at(n.name);
+                if (keys) {
+                    o.key = keys->intern(o.name);
+                    o.name = keys->name(o.key);
+                }
+            }
+            switch (o.type) {
+            case STRING: {
+                o.obj = string_at(n.value);
+            } break;
+            case INTEGER: {
+                if (n.is_unsigned)
+                    o.obj = n.value;
+                else
+                    o.obj = static_cast<int64_t>(n.value);
+            } break;
+            case FLOAT: {
+                double d;
+                memcpy(&d, &n.value, sizeof(d));
+                o.obj = d;
+            } break;
+            case BOOLEAN: {
+                o.obj = n.value != 0;
+            } break;
+            case TOP:
+            case OBJECT:
+            case ARRAY:
+            case JSONNULL: {
+                if ((o.type == TOP || o.type == ARRAY) != (i == 0) &&
+                    o.type != ARRAY)
+                    throw bad();
+            } break;
+            default:
+                throw bad();
+            }
+        }
+        if (index_threshold) {
+            for (size_t i = 0; i < count; ++i) {
+                jsonobj &o = at(i);
+                if (o.type != TOP && o.type != OBJECT)
+                    continue;
+                size_t members = o.size();
+                if (members >= index_threshold)
+                    o.obj = index_members(o.child, members, *nodes);
+            }
+        }
+    }
+
+    // Convert a number token straight from its text and hand it to the
+    // handler. Doubles are exactly rounded; integers out of int64_t range
+    // follow overflow_policy.
+    template <typename Handler>
+    bool
+    number_value(Handler &h, valuetype type, std::string_view value) {
+        if constexpr (std::is_same_v<Handler, dom_builder>) {
+            if (lazy_numbers)
+                return lazy_number_value(h, type, value);
+        }
+        const char *first = value.data();
+        const char *last = first + value.size();
+        if (type == INTEGER) {
+            int64_t i;
+            if (std::from_chars(first, last, i).ec == std::errc())
+                return h.int64(i);
+            if (overflow_policy == OVERFLOW_THROW)
+                throw std::runtime_error("Bad Json: Integer overflow.\n");
+            uint64_t u;
+            if (overflow_policy == OVERFLOW_UNSIGNED_OR_FLOAT &&
+                std::from_chars(first, last, u).ec == std::errc())
+                return h.uint64(u);
+        }
+        return h.float64(lazy_number::to_double(value));
+    }
+
+    // The same keeping the text for the tree. Up to 18 digits always fit
+    // int64_t; only longer integers are converted now, to sort them by
+    // overflow_policy as above.
+    bool
+    lazy_number_value(dom_builder &h, valuetype type, std::string_view value) {
+        bool is_unsigned = false;
+        if (type == INTEGER && value.size() - (value[0] == '-') > 18) {
+            const char *first = value.data();
+            const char *last = first + value.size();
+            int64_t i;
+            uint64_t u;
+            if (std::from_chars(first, last, i).ec != std::errc()) {
+                if (overflow_policy == OVERFLOW_THROW)
+                    throw std::runtime_error("Bad Json: Integer overflow.\n");
+                if (overflow_policy == OVERFLOW_UNSIGNED_OR_FLOAT &&
+                    std::from_chars(first, last, u).ec == std::errc())
+                    is_unsigned = true;
+                else
+                    type = FLOAT;
+            }
+        }
+        return h.number(type, value, is_unsigned);
+    }
+
+    // A value where an object member or an array element is expected;
+    // `after` is the state to go on with once the value is complete.
+    // Throws error if the token can not start a value, and returns what
+    // the handler returned.
+    template <typename Handler>
+    bool
+    parse_value(status_stack &machine_status, Handler &h,
+                valuetype type, std::string_view value, valuetype after,
+                const char *error) {
+        switch (type) {
+        case LBRACE: {
+            machine_status.top() = after;
+            machine_status.push(PARSE_OBJECT_INIT_CONTENT_WAIT);
+            return h.start_object();
+        }
+        case LBRACKET: {
+            machine_status.top() = after;
+            machine_status.push(PARSE_ARRAY_INIT_CONTENT_WAIT);
+            return h.start_array();
+        }
+        case FLOAT:
+        case INTEGER: {
+            machine_status.top() = after;
+            return number_value(h, type, value);
+        }
+        case STRING: {
+            machine_status.top() = after;
+            return h.string(value);
+        }
+        case BOOLEAN: {
+            machine_status.top() = after;
+            return h.boolean(value == "true");
+        }
+        case JSONNULL: {
+            machine_status.top() = after;
+            return h.null();
+        }
+        default:
+            throw std::runtime_error(error);
+        }
+    }
+
+    // Feed one token into the parsing status machine. Returns false once the
+    // top-level object is closed, or the handler stopped, and no more tokens
+    // are wanted.
+    template <typename Handler>
+    bool
+    parse_token(parse_context &ctx, Handler &h, valuetype type,
+                std::string_view value) {
+        status_stack &machine_status = ctx.machine_status;
+        if (machine_status.empty() || ctx.stopped)
+            return false;
+#ifdef SLOWJSON_STATS
+        ctx.count(type);
+#endif
+        bool go = true;
+
+        switch (machine_status.top()) {
+        // The init state needs to be dealed with seperately.
+        // The top level is an object or an array, we are expecting LBRACE or
+        // LBRACKET. After receiving it, we transform into
+        // PARSE_OBJECT_INIT_CONTENT_WAIT (PARSE_ARRAY_INIT_CONTENT_WAIT), in
+        // case the package has no content.
+        case PARSE_INIT: {
+            if (type == LBRACE) {
+                machine_status.top() = PARSE_OBJECT_INIT_CONTENT_WAIT;
+                go = h.start_object();
+            } else if (type == LBRACKET) {
+                machine_status.top() = PARSE_ARRAY_INIT_CONTENT_WAIT;
+                go = h.start_array();
+            } else {
+                throw std::runtime_error(
+                    "Bad Json: Not starting with '{' or '['.\n");
+            }
+        } break;
+
+        // When creating a new json object, there might be few cases
+        // expected: (a). the object has content, therefore the machine
+        // transfrom into PARSE_COLON_WAIT. (b). the object has no content,
+        // in the case of getting syntax RBRACE. Pop machine_status Notice
+        // that we will deal with array seperately. For (a) the procedure is
+        // actually the same of PARSE_NAME_WAIT.
+        case PARSE_OBJECT_INIT_CONTENT_WAIT: {
+            switch (type) {
+            case STRING: {
+                // Handing the name to the handler, waiting for the
+                // compelete unit to complete.
+                go = h.key(value);
+                // Transforming
+                machine_status.top() = PARSE_COLON_WAIT;
+            } break;
+            case RBRACE: {
+                machine_status.pop();
+                go = h.end_object();
+            } break;
+            default:
+                throw std::runtime_error("Bad Json: Bad expression.\n");
+            }
+        } break;
+
+        // Since the array will be dealed with seperately, here we expect
+        // these syntaxs: (a) STRING Then we will transform into
+        // PARSE_COLON_WAIT.
+        case PARSE_NAME_WAIT: {
+            if (type != STRING)
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            // Handing the name to the handler, waiting for the compelete
+            // unit to complete.
+            go = h.key(value);
+            // Transforming
+            machine_status.top() = PARSE_COLON_WAIT;
+        } break;
+
+        // This is the most complicated part of the design. We are expecting:
+        // (a) LBRACE. This means that a new object will be constructed.
+        //     We need to transform into PARSE_COMMA_WAIT,
+        //     and push a PARSE_OBJECT_INIT_CONTENT_WAIT.
+        // (b) LBRACKET. This means that a new array will be constructed. We
+        // need to transform
+        //     into PARSE_COMMA_WAIT, and push a PARSING_ARRAY_INIT.
+        // (c) FLOAT, INTEGER, STRING, BOOLEAN or JSONNULL. This is the value
+        //     of the member named before. The handler gets it, and we
+        //     transform into PARSE_COMMA_WAIT.
+        case PARSE_VALUE_WAIT: {
+            go = parse_value(machine_status, h, type, value, PARSE_COMMA_WAIT,
+                             "Bad Json: Illegal value.\n");
+        } break;
+
+        // Since the array will be dealed with seperately, we are simply
+        // expecting these syntaxs: (a) COMMA. This means that the package is
+        // not done, transform into PARSE_NAME_WAIT for next item. (b)
+        // RBRACE. This means that the package is done, Pop machine_status.
+        case PARSE_COMMA_WAIT: {
+            switch (type) {
+            case COMMA: {
+                machine_status.top() = PARSE_NAME_WAIT;
+            } break;
+            case RBRACE: {
+                machine_status.pop();
+                go = h.end_object();
+            } break;
+            default:
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            }
+        } break;
+
+        // Since the array will be dealed with seperately, we are simply
+        // expecting COLON.
+        case PARSE_COLON_WAIT: {
+            if (type != COLON)
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            // Transforming
+            machine_status.top() = PARSE_VALUE_WAIT;
+        } break;
+
+        // Abolished. Dont generate this token.
+        case PARSE_QUOTATION_WAIT: {
+        } break;
+
+        // The init state needs to be dealed with seperately.
+        // There are four targets actually, the syntaxs are as follows:
+        // (a) VALUE. including FLOAT, INTEGER, STRING, BOOLEAN, JSONNULL.
+        //     We need to transform into PARSING_ARRAY_COMMA_WAIT.
+        // (b) LBRACE. We need to transform into PARSING_ARRAY_COMMA_WAIT,
+        //     and push a PARSE_OBJECT_INIT_CONTENT_WAIT into machine_status.
+        // (c) LBRACKET. We need to transform into PARSING_ARRAY_COMMA_WAIT,
+        //     and push a PARSE_ARRAY_INIT into machine_status.
+        // (d) RBRACKET. Pop machine_status.
+        case PARSE_ARRAY_INIT_CONTENT_WAIT: {
+            if (type == RBRACKET) {
+                machine_status.pop();
+                go = h.end_array();
+            } else {
+                go = parse_value(machine_status, h, type, value,
+                                 PARSE_ARRAY_COMMA_WAIT,
+                                 "Bad Json: Bad token stream.\n");
+            }
+        } break;
+
+        // For array value parsing, we are expecting these syntaxs:
+        // (a) VALUE. including LBRACE, LBRACKET, FLOAT, INTEGER, STRING,
+        // BOOLEAN, JSONNULL. We need to transform into
+        // PARSING_ARRAY_COMMA_WAIT; LBRACE and LBRACKET also push a
+        // PARSE_OBJECT_INIT_CONTENT_WAIT or PARSE_ARRAY_INIT into
+        // machine_status.
+        case PARSE_ARRAY_VALUE_WAIT: {
+            go = parse_value(machine_status, h, type, value,
+                             PARSE_ARRAY_COMMA_WAIT, "Bad Json: Bad value.\n");
+        } break;
+
+        // For array comma parsing, we are expecting these syntaxs:
+        // (a) COMMA. It shows that there will be more values. Transform into
+        // PARSING_ARRAY_VALUE_WAIT. (b) RBRACKET. It indicates the end of
+        // array. Pop machine_status.
+        case PARSE_ARRAY_COMMA_WAIT: {
+            switch (type) {
+            case COMMA: {
+                machine_status.top() = PARSE_ARRAY_VALUE_WAIT;
+            } break;
+            case RBRACKET: {
+                machine_status.pop();
+                go = h.end_array();
+            } break;
+            default:
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            }
+        } break;
+
+        default:
+            throw std::runtime_error("Bad Json: Bad status.\n");
+            break;
+        }
+        if (!go)
+            ctx.stopped = true;
+        return go && !machine_status.empty();
+    }
+
+    struct stream_state {
+        tokenizer t;
+        parse_context ctx;
+        dom_builder b;
+        bool done; // The top-level object is closed
+
+        explicit stream_state(json_storage &s) : b(s), done(false) {}
+    };
+
+    // Run token_stream through the parsing status machine. Returns false if
+    // the handler stopped.
+    template <typename Handler>
+    bool
+    build_from_tokens(Handler &h) {
+        parse_context &ctx = context;
+        ctx.reset();
+        for (auto &i : token_stream) {
+            if (!parse_token(ctx, h, i.token_type, i.token_value))
+                break;
+        }
+#ifdef SLOWJSON_STATS
+        count_parse(ctx, false);
+#endif
+        if (ctx.stopped)
+            return false;
+        if (!ctx.machine_status.empty())
+            throw std::runtime_error("Bad Json: Unexpected end.\n");
+        return true;
+    }
+
+    // Build the structural index of the material if tokenizing through it
+    // pays off. It does when tokens are long (strings, long numbers); on
+    // text made of short tokens, and on small documents where building the
+    // index costs more than it saves, the scalar scan is faster. The
+    // density of entries is judged from the first 4 KiB.
+    bool
+    use_index() {
+        static constexpr size_t sample = 4096;
+        static constexpr size_t min_bytes_per_entry = 4;
+        return material.size() > sample &&
+               structural.build(material.substr(0, sample)) &&
+               sample >= min_bytes_per_entry * structural.positions.size() &&
+               structural.build(material);
+    }
+
+    // Run the material through the tokenizer and the parsing status machine
+    // in one pass, so token_stream is never built. Like tokenize(), the
+    // tokenizer jumps between the entries of the structural index when
+    // use_index() says so, and scans every byte otherwise. Returns false if
+    // the handler stopped.
+    template <typename Handler>
+    bool
+    build_from_material(Handler &h) {
+        parse_context &ctx = context;
+        ctx.reset();
+        tokenizer &t = scanner;
+        t.reset();
+        auto emit = [this, &ctx, &h](valuetype type, std::string_view value) {
+            return parse_token(ctx, h, type, value);
+        };
+        const char *first = material.data();
+        const char *last = first + material.size();
+        bool go = use_index()
+                      ? t.scan_indexed(first, last, structural.positions, emit)
+                      : t.scan(first, last, emit);
+        if (go)
+            t.finish(emit);
+#ifdef SLOWJSON_STATS
+        count_parse(ctx, true);
+#endif
+        if (ctx.stopped)
+            return false;
+        if (!ctx.machine_status.empty())
+            throw std::runtime_error("Bad Json: Unexpected end.\n");
+        return true;
+    }
+
+public:
+    // parse stored token_stream, generating parsed_obj.
+    void
+    parse() {
+        stats_scope scope(*this, parse_stats::PHASE_PARSE);
+        clear();
+        dom_builder b(*this);
+        build_from_tokens(b);
+    }
+
+    // parse the material in one pass, generating parsed_obj.
+    void
+    parse_direct() {
+        stats_scope scope(*this, parse_stats::PHASE_PARSE);
+        clear();
+        dom_builder b(*this);
+        build_from_material(b);
+    }
+
+    // parse the material in one pass, handing every event to handler (see
+    // sax_handler) instead of building a tree. Returns false if the handler
+    // stopped the parse.
+    template <typename Handler>
+    bool
+    parse_sax(Handler &handler) {
+        stats_scope scope(*this, parse_stats::PHASE_PARSE);
+        return build_from_material(handler);
+    }
+
+    // Push-mode parsing: hand a document over in chunks split anywhere, as
+    // they arrive, then call finish(). The tree grows as tokens complete and
+    // only a token cut by a chunk boundary is buffered. The first feed()
+    // drops the previous material and tree, and all strings are copied, so
+    // the chunks need not outlive the call. Do not move the storage between
+    // the first feed() and finish().
+    void
+    feed(const char *data, size_t size) {
+        stats_scope scope(*this, parse_stats::PHASE_PARSE, size);
+        if (!stream) {
+            release_material();
+            stream = std::make_unique<stream_state>(*this);
+        }
+        stream_state &s = *stream;
+        if (s.done)
+            return;
+        auto emit = [this, &s](valuetype type, std::string_view value) {
+            return parse_token(s.ctx, s.b, type, value);
+        };
+        try {
+            if (!s.t.scan(data, data + size, emit))
+                s.done = true;
+        } catch (...) {
+            stream.reset();
+            throw;
+        }
+    }
+
+    // End of the fed document: flush a trailing token and check that the
+    // top-level object was closed.
+    void
+    finish() {
+        if (!stream)
+            throw std::runtime_error("Bad Json: Unexpected end.\n");
+        stats_scope scope(*this, parse_stats::PHASE_PARSE, 0);
+        stream_state &s = *stream;
+        auto emit = [this, &s](valuetype type, std::string_view value) {
+            return parse_token(s.ctx, s.b, type, value);
+        };
+        try {
+            if (!s.done)
+                s.t.finish(emit);
+        } catch (...) {
+            stream.reset();
+            throw;
+        }
+        bool complete = s.ctx.machine_status.empty();
+#ifdef SLOWJSON_STATS
+        count_parse(s.ctx, true);
+#endif
+        stream.reset();
+        if (!complete)
+            throw std::runtime_error("Bad Json: Unexpected end.\n");
+    }
+
+    // Parse the json file at path, gzip or zstd compressed or not (see
+    // compressed_reader), without ever holding all of its text. Another
+    // thread decompresses the next chunk_size bytes into one of two buffers
+    // while this one feed()s the other, so the two overlap and only two
+    // chunks of text are kept. As with feed(), the tree has its own copy of
+    // the strings.
+    void
+    parse_compressed_file(const std::string &path,
+                          size_t chunk_size = 1 << 18) {
+        compressed_reader reader(path);
+        chunk_size = std::max<size_t>(chunk_size, 1);
+        struct buffer {
+            std::vector<char> text;
+            size_t size = 0;
+            bool full = false; // Waiting for the parser
+        };
+        buffer buffers[2];
+        buffers[0].text.resize(chunk_size);
+        buffers[1].text.resize(chunk_size);
+        std::mutex lock;
+        std::condition_variable changed;
+        bool stopping = false;
+        std::exception_ptr error;
+
+        // A chunk of size 0 is the end of the text, or an error.
+        std::thread decompress([&]() {
+            for (size_t i = 0;; i ^= 1) {
+                buffer &b = buffers[i];
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&]() { return !b.full || stopping; });
+                    if (stopping)
+                        return;
+                }
+                size_t n = 0;
+                std::exception_ptr failed;
+                try {
+                    n = reader.read(b.text.data(), chunk_size);
+                } catch (...) {
+                    failed = std::current_exception();
+                }
+                std::lock_guard<std::mutex> guard(lock);
+                b.size = n;
+                b.full = true;
+                error = failed;
+                changed.notify_all();
+                if (n == 0)
+                    return;
+            }
+        });
+        auto stop = [&]() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            changed.notify_all();
+            decompress.join();
+        };
+
+        try {
+            stream.reset(); // Start on a new document
+            for (size_t i = 0;; i ^= 1) {
+                buffer &b = buffers[i];
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&]() { return b.full; });
+                    if (error)
+                        std::rethrow_exception(error);
+                }
+                if (b.size == 0)
+                    break;
+                feed(b.text.data(), b.size);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    b.full = false;
+                }
+                changed.notify_all();
+            }
+        } catch (...) {
+            stop();
+            stream.reset();
+            throw;
+        }
+        stop();
+        finish();
+    }
+
+    // parse the material in one pass into a tape instead of the jsonobj
+    // tree. The tape keeps its own copy of the strings.
+    void
+    parse_tape(json_tape &tape) {
+        stats_scope scope(*this, parse_stats::PHASE_PARSE);
+        tape.clear();
+        tape.entries.reserve(material.size() / 8);
+        tape_builder b{tape};
+        build_from_material(b);
+    }
+
+    // parse the material in one pass into a compact_tree instead of the
+    // jsonobj tree. The tree keeps its own copy of the strings.
+    void
+    parse_compact(compact_tree &tree) {
+        stats_scope scope(*this, parse_stats::PHASE_PARSE);
+        tree.clear();
+        tree.nodes.reserve(material.size() / 16);
+        build_from_material(tree);
+    }
+
+    // parse the material in one pass straight into out, a type bound with
+    // SLOWJSON_BIND (see struct_decoder), without building a tree. out may
+    // be partly filled when this throws.
+    template <typename T>
+    void
+    parse_into(T &out) {
+        stats_scope scope(*this, parse_stats::PHASE_PARSE);
+        struct_decoder d(out);
+        build_from_material(d);
+    }
+
+    // Rebuild parsed_obj from a tape, for code written against jsonobj.
+    // Strings are copied into the storage, so the tape may go away after.
+    void
+    load_tape(const json_tape &tape) {
+        clear();
+        dom_builder b(*this);
+        tape.walk(b);
+    }
+
+    // Append parsed_obj to out as a binary snapshot (see snapshot_format),
+    // stamped with the fingerprint of the material, which has to be the
+    // text parsed_obj was parsed from.
+    void
+    snapshot_to(std::string &out) const {
+        typedef snapshot_format::node node;
+        std::vector<node> list;
+        std::string pool;
+        std::unordered_map<std::string_view, uint32_t> names;
+        auto add_string = [&pool](std::string_view s) {
+            if (pool.size() + sizeof(uint32_t) + s.size() >= UINT32_MAX)
+                throw std::runtime_error(
+                    "Bad Json: Too large for a snapshot.\n");
+            uint32_t offset = static_cast<uint32_t>(pool.size());
+            uint32_t length = static_cast<uint32_t>(s.size());
+            pool.append(reinterpret_cast<const char *>(&length),
+                        sizeof(length));
+            pool.append(s.data(), s.size());
+            return offset;
+        };
+        auto add = [&](const jsonobj &o, bool member) {
+            if (list.size() >= snapshot_format::none)
+                throw std::runtime_error(
+                    "Bad Json: Too large for a snapshot.\n");
+            node n{};
+            n.type = static_cast<uint8_t>(o.type);
+            n.name = n.next = n.child = snapshot_format::none;
+            if (member) {
+                auto found = names.find(o.name);
+                if (found == names.end())
+                    found = names.emplace(o.name, add_string(o.name)).first;
+                n.name = found->second;
+            }
+            switch (o.type) {
+            case STRING: {
+                n.value = add_string(std::get<std::string_view>(o.obj));
+            } break;
+            case INTEGER: {
+                jsonobj::value_holder v = o.number();
+                if (auto u = std::get_if<uint64_t>(&v)) {
+                    n.is_unsigned = 1;
+                    n.value = *u;
+                } else {
+                    n.value = static_cast<uint64_t>(std::get<int64_t>(v));
+                }
+            } break;
+            case FLOAT: {
+                double d = std::get<double>(o.number());
+                memcpy(&n.value, &d, sizeof(d));
+            } break;
+            case BOOLEAN: {
+                n.value = std::get<bool>(o.obj);
+            } break;
+            default:
+                break;
+            }
+            list.push_back(n);
+            return static_cast<uint32_t>(list.size() - 1);
+        };
+
+        // Depth first, each level remembering the next node to write and
+        // the node whose child or next link is waiting for it.
+        struct level {
+            const jsonobj *pending;
+            uint32_t link;
+            bool is_child;
+            bool in_object;
+        };
+        std::vector<level> stack;
+        add(parsed_obj, false);
+        if (parsed_obj.child)
+            stack.push_back(
+                {parsed_obj.child, 0, true, parsed_obj.type == TOP});
+        while (!stack.empty()) {
+            level &l = stack.back();
+            const jsonobj *o = l.pending;
+            if (!o) {
+                stack.pop_back();
+                continue;
+            }
+            uint32_t i = add(*o, l.in_object);
+            (l.is_child ? list[l.link].child : list[l.link].next) = i;
+            l.pending = o->next;
+            l.link = i;
+            l.is_child = false;
+            if (o->child)
+                stack.push_back({o->child, i, true, o->type == OBJECT});
+        }
+
+        snapshot_format::header h{};
+        memcpy(h.magic, "SLOWJSON", sizeof(h.magic));
+        h.version = snapshot_format::version;
+        h.byte_order = snapshot_format::byte_order;
+        h.source = snapshot_format::fingerprint(material);
+        h.node_count = list.size();
+        h.strings_size = pool.size();
+        size_t start = out.size();
+        out.append(sizeof(h), '\0');
+        out.append(reinterpret_cast<const char *>(list.data()),
+                   list.size() * sizeof(node));
+        out.append(pool);
+        h.checksum = snapshot_format::hash(
+            std::string_view(out).substr(start + sizeof(h)));
+        memcpy(&out[start], &h, sizeof(h));
+    }
+
+    // Write parsed_obj as a snapshot to the file at path. It is written
+    // next to it and renamed over it, so readers never see half of it.
+    void
+    save_snapshot(const std::string &path) const {
+        std::string image;
+        snapshot_to(image);
+#ifdef SLOWJSON_HAS_MMAP
+        std::string temporary = path + ".XXXXXX";
+        int fd = mkstemp(&temporary[0]);
+        if (fd < 0)
+            throw std::runtime_error("bad file");
+        const char *p = image.data();
+        size_t left = image.size();
+        while (left) {
+            ssize_t n = ::write(fd, p, left);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                break;
+            p += n;
+            left -= n;
+        }
+        if (::close(fd) != 0 || left ||
+            rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            throw std::runtime_error("bad file");
+        }
+#else
+        std::ofstream f(path, std::ios::out | std::ios::binary |
+                                  std::ios::trunc);
+        if (!f.write(image.data(), image.size()) || !f.flush())
+            throw std::runtime_error("bad file");
+#endif
+    }
+
+    // Take parsed_obj from the snapshot at path, if it is whole and was
+    // saved from the json text with this fingerprint (see
+    // snapshot_format::fingerprint()). The file is mapped where possible
+    // and the tree points into it: nothing is parsed, the nodes are made in
+    // one allocation and the strings are not copied. The material is
+    // dropped. Returns false, leaving the storage as it was, if the
+    // snapshot is missing, of another version, stale or damaged.
+    bool
+    load_snapshot(const std::string &path, uint64_t source) {
+#ifdef SLOWJSON_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        mapped_file m;
+        bool mapped = m.map(fd);
+        ::close(fd);
+        if (!mapped || !snapshot_usable(m.view(), source))
+            return false;
+        stats_scope scope(*this, parse_stats::PHASE_READ, m.view().size());
+        release_material();
+        mapping = std::move(m);
+        build_from_snapshot(mapping.view());
+#else
+        std::ifstream f(path, std::ios::in | std::ios::binary);
+        if (!f.is_open())
+            return false;
+        std::string image((std::istreambuf_iterator<char>(f)),
+                          std::istreambuf_iterator<char>());
+        if (!snapshot_usable(image, source))
+            return false;
+        stats_scope scope(*this, parse_stats::PHASE_READ, image.size());
+        release_material();
+        json_material = std::move(image);
+        build_from_snapshot(json_material);
+#endif
+        return true;
+    }
+
+    // The same from a snapshot in memory, which must outlive the tree.
+    bool
+    load_snapshot_view(std::string_view image, uint64_t source) {
+        if (!snapshot_usable(image, source))
+            return false;
+        stats_scope scope(*this, parse_stats::PHASE_READ, image.size());
+        release_material();
+        build_from_snapshot(image);
+        return true;
+    }
+
+    // Parse the json file at json_path by way of a snapshot at
+    // snapshot_path: the tree is loaded from the snapshot when it was saved
+    // from the same text, else the file is parsed and the snapshot written
+    // anew. A snapshot that cannot be written is skipped, the next call
+    // parses again.
+    void
+    read_file_cached(const std::string &json_path,
+                     const std::string &snapshot_path) {
+        read_file(json_path);
+        uint64_t source = snapshot_format::fingerprint(material);
+        try {
+            if (load_snapshot(snapshot_path, source))
+                return;
+        } catch (std::runtime_error &) {
+            // Whole but malformed: parse the source again.
+            read_file(json_path);
+        }
+        parse_direct();
+        try {
+            save_snapshot(snapshot_path);
+        } catch (std::runtime_error &) {
+        }
+    }
+};
+
+/**
+ * @brief A value of a document parsed on demand, see json_storage::parse_lazy().
+ * Only the structural index is built up front. A value is decoded when it is
+ * read, and objects and arrays that are passed over are skipped whole, so
+ * parts that are never visited are never decoded (nor validated). Offers the
+ * accessors of jsonobj. Valid until the storage reads or parses again.
+ */
+class lazy_value {
+private:
+    json_storage *js;
+    uint32_t entry; // Entry of the value in the structural index
+    uint32_t key;   // Entry of its member name, or entry if it has none
+
+public:
+    lazy_value(json_storage *s, uint32_t e, uint32_t k)
+        : js(s), entry(e), key(k) {}
+
+    // Walks the members of an object or the elements of an array.
+    class iterator {
+    private:
+        json_storage *js;
+        uint32_t at; // First entry of the current member, UINT32_MAX at end
+        bool in_object;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = lazy_value;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = lazy_value;
+
+        iterator() : js(nullptr), at(UINT32_MAX), in_object(false) {}
+        iterator(json_storage *s, uint32_t first, bool object)
+            : js(s), at(first), in_object(object) {
+            char c = js->lazy_char(at);
+            if (c == (in_object ? '}' : ']'))
+                at = UINT32_MAX;
+        }
+
+        // A member is a name, a colon and the value.
+        lazy_value
+        operator*() const {
+            if (!in_object)
+                return lazy_value(js, at, at);
+            if (js->lazy_char(at) != '"' || js->lazy_char(at + 2) != ':')
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            return lazy_value(js, at + 3, at);
+        }
+
+        iterator &
+        operator++() {
+            uint32_t e = js->lazy_skip(in_object ? at + 3 : at);
+            char c = js->lazy_char(e);
+            if (c == ',')
+                at = e + 1;
+            else if (c == (in_object ? '}' : ']'))
+                at = UINT32_MAX;
+            else
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            return *this;
+        }
+
+        iterator
+        operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &o) const { return at == o.at; }
+        bool operator!=(const iterator &o) const { return at != o.at; }
+    };
+
+    valuetype
+    type() const {
+        switch (js->lazy_char(entry)) {
+        case '{':
+            return entry == 0 ? TOP : OBJECT;
+        case '[':
+            return ARRAY;
+        case '"':
+            return STRING;
+        case 't':
+        case 'f':
+            return BOOLEAN;
+        case 'n':
+            return JSONNULL;
+        default: {
+            // A number: floating if it has a fraction or an exponent.
+            std::string_view text = js->material.substr(
+                js->structural.positions[entry],
+                entry + 1 < js->structural.positions.size()
+                    ? js->structural.positions[entry + 1] -
+                          js->structural.positions[entry]
+                    : std::string_view::npos);
+            size_t end = text.find_first_of(" \t\n\r,]}");
+            return text.substr(0, end).find_first_of(".eE") ==
+                           std::string_view::npos
+                       ? INTEGER
+                       : FLOAT;
+        }
+        }
+    }
+
+    // Whether the member name is name, without decoding it unless it has
+    // escapes.
+    bool
+    name_is(std::string_view name) const {
+        std::string_view raw;
+        if (key == entry)
+            return name.empty();
+        return js->lazy_raw_string(key, raw) ? raw == name
+                                             : this->name() == name;
+    }
+
+    // The member name, empty for array elements and the top-level object.
+    std::string_view
+    name() const {
+        if (key == entry)
+            return std::string_view();
+        std::string_view raw;
+        if (js->lazy_raw_string(key, raw))
+            return raw;
+        jsonobj n;
+        js->lazy_decode(key, n);
+        return std::get<std::string_view>(n.obj);
+    }
+
+    iterator
+    begin() const {
+        char c = js->lazy_char(entry);
+        if (c != '{' && c != '[')
+            return iterator();
+        return iterator(js, entry + 1, c == '{');
+    }
+
+    iterator
+    end() const {
+        return iterator();
+    }
+
+    size_t
+    size() const {
+        size_t n = 0;
+        for (iterator i = begin(); i != end(); ++i)
+            ++n;
+        return n;
+    }
+
+    // The member named key. Members before it are skipped without being
+    // decoded.
+    std::optional<lazy_value>
+    find(std::string_view name) const {
+        if (js->lazy_char(entry) != '{')
+            return std::nullopt;
+        for (iterator i = begin(); i != end(); ++i) {
+            lazy_value member = *i;
+            if (member.name_is(name))
+                return member;
+        }
+        return std::nullopt;
+    }
+
+    lazy_value
+    operator[](std::string_view name) const {
+        std::optional<lazy_value> member = find(name);
+        if (!member)
+            throw std::out_of_range("No such key.\n");
+        return *member;
+    }
+
+    // The index-th member or element; those before it are skipped.
+    lazy_value
+    at(size_t index) const {
+        iterator i = begin();
+        for (; i != end() && index; --index)
+            ++i;
+        if (i == end())
+            throw std::out_of_range("No such index.\n");
+        return *i;
+    }
+
+    // Decode the value as T, like jsonobj::get().
+    template <typename T>
+    T
+    get() const {
+        char c = js->lazy_char(entry);
+        if (c == '{' || c == '[')
+            throw std::runtime_error("Bad type.\n");
+        jsonobj n;
+        js->lazy_decode(entry, n);
+        return n.get<T>();
+    }
+};
+
+/**
+ * @brief A set of JSON Pointers (RFC 6901) compiled once into a trie.
+ * A "*" segment stands for every element of an array or member of an
+ * object. Matching walks a lazily parsed document along the trie only, so
+ * members and elements off every path are skipped without being decoded.
+ */
+class path_query {
+private:
+    struct state {
+        std::vector<std::pair<std::string, uint32_t>> names; // Segment, state
+        uint32_t any;                // State after "*", 0 if none
+        std::vector<size_t> matches; // Paths ending here
+    };
+
+    std::vector<state> states; // states[0] is the top-level value
+    size_t paths;
+
+    // Append one value to the results of the paths ending at state s, and
+    // go on with its members or elements.
+    void
+    walk(const lazy_value &v, uint32_t s,
+         std::vector<std::vector<lazy_value>> &results) const {
+        const state &st = states[s];
+        for (size_t m : st.matches)
+            results[m].push_back(v);
+        if (st.names.empty() && !st.any)
+            return;
+        valuetype t = v.type();
+        if (t != TOP && t != OBJECT && t != ARRAY)
+            return;
+        // A duplicate member name keeps its first value, as find() does.
+        // Without "*", stop once every named segment was found.
+        uint64_t seen_few = 0;
+        std::vector<bool> seen_many(st.names.size() > 64 ? st.names.size() : 0);
+        auto seen = [&](size_t k) {
+            return seen_many.empty() ? (seen_few >> k & 1) != 0 : seen_many[k];
+        };
+        size_t found = 0;
+        size_t index = 0;
+        for (lazy_value::iterator i = v.begin(); i != v.end(); ++i, ++index) {
+            lazy_value child = *i;
+            for (size_t k = 0; k < st.names.size(); ++k) {
+                if (seen(k) || !(t == ARRAY ? index_is(st.names[k].first, index)
+                                            : child.name_is(st.names[k].first)))
+                    continue;
+                if (seen_many.empty())
+                    seen_few |= uint64_t(1) << k;
+                else
+                    seen_many[k] = true;
+                ++found;
+                walk(child, st.names[k].second, results);
+                break;
+            }
+            if (st.any)
+                walk(child, st.any, results);
+            else if (found == st.names.size())
+                break;
+        }
+    }
+
+    // An array index segment: digits without a leading zero.
+    static bool
+    index_is(std::string_view segment, size_t index) {
+        char buffer[24];
+        auto r = std::to_chars(buffer, buffer + sizeof(buffer), index);
+        return segment == std::string_view(buffer, r.ptr - buffer);
+    }
+
+    // The state after segment from state s, made if new.
+    uint32_t
+    step(uint32_t s, const std::string &segment) {
+        if (segment == "*") {
+            if (!states[s].any) {
+                states[s].any = static_cast<uint32_t>(states.size());
+                states.push_back(state{{}, 0, {}});
+            }
+            return states[s].any;
+        }
+        for (const auto &n : states[s].names) {
+            if (n.first == segment)
+                return n.second;
+        }
+        uint32_t next = static_cast<uint32_t>(states.size());
+        states[s].names.emplace_back(segment, next);
+        states.push_back(state{{}, 0, {}});
+        return next;
+    }
+
+public:
+    path_query() : states(1, state{{}, 0, {}}), paths(0) {}
+
+    // Add a path, "" being the whole document, and get its number. "~1" and
+    // "~0" in a segment stand for '/' and '~'.
+    size_t
+    add(std::string_view pointer) {
+        if (!pointer.empty() && pointer[0] != '/')
+            throw std::runtime_error("Bad pointer.\n");
+        uint32_t s = 0;
+        while (!pointer.empty()) {
+            pointer.remove_prefix(1);
+            size_t end = std::min(pointer.find('/'), pointer.size());
+            std::string segment;
+            for (size_t i = 0; i < end; ++i) {
+                if (pointer[i] != '~') {
+                    segment += pointer[i];
+                } else if (i + 1 < end &&
+                           (pointer[i + 1] == '0' || pointer[i + 1] == '1')) {
+                    segment += pointer[++i] == '0' ? '~' : '/';
+                } else {
+                    throw std::runtime_error("Bad pointer.\n");
+                }
+            }
+            pointer.remove_prefix(end);
+            s = step(s, segment);
+        }
+        states[s].matches.push_back(paths);
+        return paths++;
+    }
+
+    // Number of paths added.
+    size_t
+    size() const {
+        return paths;
+    }
+
+    // The values at each path below root, in document order.
+    std::vector<std::vector<lazy_value>>
+    match(const lazy_value &root) const {
+        std::vector<std::vector<lazy_value>> results;
+        match(root, results);
+        return results;
+    }
+
+    // The same into results, reusing its lists across documents.
+    void
+    match(const lazy_value &root,
+          std::vector<std::vector<lazy_value>> &results) const {
+        results.resize(paths);
+        for (auto &r : results)
+            r.clear();
+        walk(root, 0, results);
+    }
+};
+
+inline std::vector<std::vector<lazy_value>>
+json_storage::query(const path_query &q) {
+    return q.match(parse_lazy());
+}
+
+inline lazy_value
+json_storage::parse_lazy() {
+    stats_scope scope(*this, parse_stats::PHASE_PARSE);
+    clear();
+    if (material.size() > UINT32_MAX)
+        throw std::runtime_error("Bad Json: Too large.\n");
+    if (!structural.build(material))
+        throw std::runtime_error("Bad Json: Bad tokens.\n");
+    if (lazy_char(0) != '{' && lazy_char(0) != '[')
+        throw std::runtime_error("Bad Json: Not starting with '{' or '['.\n");
+    return lazy_value(this, 0, 0);
+}
+
+/**
+ * @brief A fixed set of worker threads running batches of tasks.
+ * run() deals the task numbers out in one contiguous range per thread, the
+ * calling thread included; a thread that runs out of work steals the upper
+ * half of another thread's remaining range.
+ */
+class thread_pool {
+private:
+    struct range {
+        std::mutex lock;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<range[]> ranges; // One per thread, the caller's first
+    size_t threads;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::function<void(size_t, size_t)> job;
+    size_t generation = 0; // Bumped by every run()
+    size_t busy = 0;       // Workers still on the current run()
+    bool stopping = false;
+
+    bool
+    next(size_t self, size_t &task) {
+        {
+            std::lock_guard<std::mutex> own(ranges[self].lock);
+            if (ranges[self].begin < ranges[self].end) {
+                task = ranges[self].begin++;
+                return true;
+            }
+        }
+        for (size_t k = 1; k < threads; ++k) {
+            range &victim = ranges[(self + k) % threads];
+            size_t first, last;
+            {
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (victim.begin >= victim.end)
+                    continue;
+                first = victim.begin + (victim.end - victim.begin) / 2;
+                last = victim.end;
+                victim.end = first;
+            }
+            std::lock_guard<std::mutex> own(ranges[self].lock);
+            ranges[self].begin = first + 1;
+            ranges[self].end = last;
+            task = first;
+            return true;
+        }
+        return false;
+    }
+
+    void
+    work(size_t self) {
+        size_t task;
+        while (next(self, task))
+            job(task, self);
+    }
+
+    void
+    loop(size_t self) {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard,
+                          [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            work(self);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0)
+                done.notify_all();
+        }
+    }
+
+public:
+    // 0 threads means one per hardware thread.
+    explicit thread_pool(unsigned count = 0)
+        : threads(count ? count
+                        : std::max(1u, std::thread::hardware_concurrency())) {
+        ranges.reset(new range[threads]);
+        for (size_t i = 1; i < threads; ++i)
+            workers.emplace_back(&thread_pool::loop, this, i);
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    size_t
+    size() const {
+        return threads;
+    }
+
+    // Call task(i, thread) for every i in [0, count) and wait for all of
+    // them. thread, below size(), tells which thread runs the task (0 is the
+    // caller) for per-thread state. Tasks must not throw.
+    template <typename Task>
+    void
+    run(size_t count, Task &&task) {
+        job = [&task](size_t i, size_t self) { task(i, self); };
+        for (size_t i = 0; i < threads; ++i) {
+            ranges[i].begin = count * i / threads;
+            ranges[i].end = count * (i + 1) / threads;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busy = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0; });
+    }
+};
+
+/**
+ * @brief Parser for newline-delimited json (NDJSON, JSON Lines).
+ * The text is cut into records at the newlines outside of strings, and the
+ * records are parsed in parallel on a thread_pool. Records are parsed in
+ * place, so the text (e.g. a mapped_file) must outlive the results.
+ */
+class ndjson_batch {
+private:
+    thread_pool pool;
+    std::vector<std::string_view> records;
+    bool intern_keys;
+
+    // Records are handed out a batch of about this many bytes at a time.
+    static constexpr size_t task_bytes = 64 * 1024;
+
+    // Group records into tasks; task i covers records
+    // [tasks[i], tasks[i + 1]).
+    std::vector<size_t>
+    make_tasks() const {
+        std::vector<size_t> tasks;
+        size_t bytes = task_bytes;
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (bytes >= task_bytes) {
+                tasks.push_back(i);
+                bytes = 0;
+            }
+            bytes += records[i].size();
+        }
+        tasks.push_back(records.size());
+        return tasks;
+    }
+
+    // Run record(i, thread) for every record. The exception of the first
+    // failing record, in input order, is rethrown once all are done.
+    template <typename Record>
+    void
+    run(Record &&record) {
+        std::vector<size_t> tasks = make_tasks();
+        std::mutex error_lock;
+        size_t error_at = records.size();
+        std::exception_ptr error;
+        pool.run(tasks.size() - 1, [&](size_t task, size_t self) {
+            for (size_t i = tasks[task]; i < tasks[task + 1]; ++i) {
+                try {
+                    record(i, self);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(error_lock);
+                    if (i < error_at) {
+                        error_at = i;
+                        error = std::current_exception();
+                    }
+                }
+            }
+        });
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+public:
+    // 0 threads means one per hardware thread.
+    explicit ndjson_batch(unsigned threads = 0)
+        : pool(threads), intern_keys(false) {}
+
+    // Intern member names into one key_pool per thread, shared by the
+    // records that thread parses.
+    void
+    set_intern_keys(bool on) {
+        intern_keys = on;
+    }
+
+    // Number of records found by the last parse() or for_each().
+    size_t
+    size() const {
+        return records.size();
+    }
+
+    // Parse every record into its own storage, in input order. With
+    // interning, the storages parsed on one thread share their pool; they
+    // can still be read from any thread once parse() returns. Each record
+    // costs a whole json_storage, with arenas of its own, made before the
+    // parse starts: for large inputs (millions of records) use for_each(),
+    // which keeps one storage per thread.
+    std::vector<json_storage>
+    parse(std::string_view text) {
+        std::vector<json_storage> docs;
+        structural_index::split_records(text, records);
+        docs.resize(records.size());
+        std::vector<std::shared_ptr<key_pool>> keys(pool.size());
+        run([&](size_t i, size_t self) {
+            if (intern_keys) {
+                if (!keys[self])
+                    keys[self] = std::make_shared<key_pool>();
+                docs[i].set_key_pool(keys[self]);
+            }
+            docs[i].read_view(records[i]);
+            docs[i].parse_direct();
+        });
+        return docs;
+    }
+
+    // Parse every record and hand it to callback(index, storage) on the
+    // thread that parsed it, in no particular order. Each thread reuses one
+    // storage, so the storage is only valid during the call.
+    template <typename Callback>
+    void
+    for_each(std::string_view text, Callback &&callback) {
+        structural_index::split_records(text, records);
+        std::vector<json_storage> docs(pool.size());
+        if (intern_keys) {
+            for (json_storage &d : docs)
+                d.set_key_pool(std::make_shared<key_pool>());
+        }
+        run([&](size_t i, size_t self) {
+            docs[self].read_view(records[i]);
+            docs[self].parse_direct();
+            callback(i, docs[self]);
+        });
+    }
+};
+
+// The body of the top-level object or array is cut at some of its top-level
+// commas and the pieces are parsed on the pool, each into nodes of its own
+// thread's arena, then linked up. To find such commas, chunks of the text
+// are first scanned in parallel without knowing whether they start inside a
+// string: the quote parity of a chunk and its bracket depth change for both
+// cases are enough for a serial pass over the chunks to fix the state at
+// every chunk start.
+inline void
+json_storage::parse_parallel(thread_pool &pool) {
+    const char *ws = " \t\n\r";
+    size_t open = material.find_first_not_of(ws);
+    size_t close = material.find_last_not_of(ws);
+    if (pool.size() == 1 || material.size() < (1 << 20) ||
+        open == std::string_view::npos ||
+        (material[open] != '{' && material[open] != '[') ||
+        material[close] != (material[open] == '{' ? '}' : ']') ||
+        material.find_first_not_of(ws, open + 1) == close) {
+        parse_direct();
+        return;
+    }
+    std::optional<stats_scope> scope;
+    scope.emplace(*this, parse_stats::PHASE_PARSE);
+    clear();
+    bool object = material[open] == '{';
+    size_t first = open + 1;
+    size_t size = close - first;
+    size_t chunks = std::min<size_t>(pool.size() * 4, size / 65536 + 1);
+    // A chunk never starts right after a backslash, so no escape crosses
+    // into it.
+    std::vector<size_t> bound(chunks + 1);
+    for (size_t i = 0; i <= chunks; ++i) {
+        size_t b = first + size * i / chunks;
+        while (b < close && material[b - 1] == '\\')
+            ++b;
+        bound[i] = i ? std::max(b, bound[i - 1]) : first;
+    }
+    auto piece = [&](size_t i) {
+        return material.substr(bound[i], bound[i + 1] - bound[i]);
+    };
+
+    struct chunk_scan {
+        bool odd_quotes;
+        int64_t delta[2]; // Depth change when starting outside/inside a string
+        bool in_string;   // Fixed state at the chunk start
+        int64_t depth;
+        size_t split; // First top-level comma, or npos
+    };
+    std::vector<chunk_scan> scan(chunks);
+    pool.run(chunks, [&](size_t i, size_t) {
+        chunk_scan &c = scan[i];
+        std::string_view text = piece(i);
+        c.delta[0] = c.delta[1] = 0;
+        c.odd_quotes = structural_index::visit_ops(
+            text, [&](size_t at, bool in_string) {
+                char ch = text[at];
+                if (ch == '{' || ch == '[')
+                    ++c.delta[in_string];
+                else if (ch == '}' || ch == ']')
+                    --c.delta[in_string];
+                return true;
+            });
+    });
+    bool in_string = false;
+    int64_t depth = 1;
+    for (chunk_scan &c : scan) {
+        c.in_string = in_string;
+        c.depth = depth;
+        depth += c.delta[in_string];
+        in_string ^= c.odd_quotes;
+    }
+    pool.run(chunks, [&](size_t i, size_t) {
+        chunk_scan &c = scan[i];
+        c.split = std::string_view::npos;
+        if (i == 0)
+            return;
+        std::string_view text = piece(i);
+        int64_t d = c.depth;
+        structural_index::visit_ops(text, [&](size_t at, bool in_string) {
+            if (in_string != c.in_string)
+                return true;
+            char ch = text[at];
+            if (ch == '{' || ch == '[') {
+                ++d;
+            } else if (ch == '}' || ch == ']') {
+                --d;
+            } else if (ch == ',' && d == 1) {
+                c.split = bound[i] + at;
+                return false;
+            }
+            return true;
+        });
+    });
+
+    std::vector<size_t> starts(1, first);
+    std::vector<size_t> ends;
+    for (chunk_scan &c : scan) {
+        if (c.split != std::string_view::npos) {
+            ends.push_back(c.split);
+            starts.push_back(c.split + 1);
+        }
+    }
+    ends.push_back(close);
+    // No top-level comma to cut at: one value, or not json at all.
+    if (starts.size() == 1) {
+        scope.reset();
+        parse_direct();
+        return;
+    }
+
+    size_t regions = starts.size();
+    std::vector<jsonobj> roots(regions);
+    std::vector<jsonobj **> tails(regions);
+    std::vector<size_t> members(regions);
+    std::vector<parse_context> contexts(regions);
+    while (thread_nodes.size() < pool.size())
+        thread_nodes.push_back(
+            std::make_unique<arena>(nodes->upstream_resource()));
+    std::mutex error_lock;
+    size_t error_at = regions;
+    std::exception_ptr error;
+    pool.run(regions, [&](size_t r, size_t self) {
+        try {
+            // Each piece is parsed as the members of an object, or elements
+            // of an array, of its own; it has to end after a complete one.
+            parse_context &ctx = contexts[r];
+            dom_builder b(*this, *thread_nodes[self], roots[r]);
+            b.keys = nullptr; // The pool is not shared between threads
+            parse_token(ctx, b, object ? LBRACE : LBRACKET, std::string_view());
+            tokenizer t;
+            auto emit = [&](valuetype type, std::string_view value) {
+                return parse_token(ctx, b, type, value);
+            };
+            if (!t.scan(material.data() + starts[r], material.data() + ends[r],
+                        emit))
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            t.finish(emit);
+            if (ctx.machine_status.size() != 1)
+                throw std::runtime_error("Bad Json: Unexpected end.\n");
+            if (ctx.machine_status.top() != PARSE_COMMA_WAIT &&
+                ctx.machine_status.top() != PARSE_ARRAY_COMMA_WAIT)
+                throw std::runtime_error("Bad Json: Bad syntax.\n");
+            tails[r] = b.slot;
+            members[r] = b.member_count.back();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(error_lock);
+            if (r < error_at) {
+                error_at = r;
+                error = std::current_exception();
+            }
+        }
+    });
+    if (error) {
+        clear();
+        std::rethrow_exception(error);
+    }
+
+    parsed_obj.type = object ? TOP : ARRAY;
+    jsonobj **slot = &parsed_obj.child;
+    size_t count = 0;
+    for (size_t r = 0; r < regions; ++r) {
+        *slot = roots[r].child;
+        slot = tails[r];
+        count += members[r];
+    }
+    if (object && index_threshold && count >= index_threshold)
+        parsed_obj.obj = index_members(parsed_obj.child, count, *nodes);
+
+#ifdef SLOWJSON_STATS
+    // Each region counted an opening token of its own, but not the comma
+    // before it nor the closing token.
+    for (parse_context &ctx : contexts)
+        count_parse(ctx, true);
+    counters.tokens[object ? LBRACE : LBRACKET] -= regions - 1;
+    counters.tokens[COMMA] += regions - 1;
+    ++counters.tokens[object ? RBRACE : RBRACKET];
+#endif
+
+    // Names are interned afterwards, on this thread.
+    if (keys) {
+        std::vector<jsonobj *> pending(1, &parsed_obj);
+        while (!pending.empty()) {
+            jsonobj *p = pending.back();
+            pending.pop_back();
+            bool members = p->type == TOP || p->type == OBJECT;
+            for (jsonobj *c = p->child; c; c = c->next) {
+                if (members) {
+                    c->key = keys->intern(c->name);
+                    c->name = keys->name(c->key);
+                }
+                if (c->child)
+                    pending.push_back(c);
+            }
+        }
+    }
+}
 
 } // namespace parse
 
-#endif
\ No newline at end of file
+#endif
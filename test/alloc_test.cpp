@@ -0,0 +1,179 @@
+#include <bits/stdc++.h>
+#include "../include/slowjson.hpp"
+
+// Every heap allocation of the program is counted: once a storage has seen
+// its documents, parsing them again after reset() must not allocate.
+
+static size_t allocations = 0;
+
+void *
+operator new(size_t size) {
+    ++allocations;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *
+operator new(size_t size, std::align_val_t align) {
+    ++allocations;
+    size_t a = std::max(static_cast<size_t>(align), sizeof(void *));
+    if (void *p = aligned_alloc(a, (size + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc();
+}
+
+void
+operator delete(void *p) noexcept {
+    free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void
+operator delete(void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void
+operator delete(void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+static std::string
+make_document(int records, int depth) {
+    std::string s = "{\"records\":[";
+    for (int i = 0; i < records; ++i) {
+        if (i)
+            s += ',';
+        s += "{\"id\":" + std::to_string(i * 7919) +
+             ",\"score\":" + std::to_string(i * 0.25) +
+             ",\"name\":\"user\\t" + std::to_string(i) +
+             " with an escaped name long enough to leave the small buffer\"" +
+             ",\"tags\":[\"a\",\"b\",true,null],\"big\":18446744073709551615}";
+    }
+    s += "],\"deep\":";
+    for (int i = 0; i < depth; ++i)
+        s += "[";
+    for (int i = 0; i < depth; ++i)
+        s += "]";
+    // Enough members for a member_index.
+    s += ",\"wide\":{";
+    for (int i = 0; i < 40; ++i)
+        s += (i ? ",\"k" : "\"k") + std::to_string(i) + "\":" +
+             std::to_string(i);
+    return s + "}}";
+}
+
+// Upstream for the arenas of a storage, counting the chunks it hands out
+// and those still out.
+class counting_resource : public std::pmr::memory_resource {
+public:
+    size_t taken = 0;
+    size_t live = 0;
+
+private:
+    void *
+    do_allocate(size_t bytes, size_t align) override {
+        ++taken;
+        ++live;
+        return std::pmr::new_delete_resource()->allocate(bytes, align);
+    }
+
+    void
+    do_deallocate(void *p, size_t bytes, size_t align) override {
+        --live;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+    }
+
+    bool
+    do_is_equal(const std::pmr::memory_resource &o) const noexcept override {
+        return this == &o;
+    }
+};
+
+// The chunks of the nodes and token strings come from the upstream given to
+// the storage, are kept by reset(), and go back by shrink_to_fit() or when
+// the storage is destroyed.
+static bool
+upstream_test(const std::string &d) {
+    counting_resource upstream;
+    {
+        ecl::json_storage js(&upstream);
+        js.read(d);
+        js.tokenize();
+        js.parse();
+        if (upstream.taken == 0 || upstream.live == 0)
+            return false;
+        size_t taken = upstream.taken;
+        size_t live = upstream.live;
+        js.reset();
+        js.read(d);
+        js.tokenize();
+        js.parse();
+        if (upstream.taken != taken || upstream.live != live)
+            return false;
+        js.shrink_to_fit();
+        if (upstream.live != 0)
+            return false;
+        js.read(d);
+        js.parse_direct();
+        if (upstream.live == 0)
+            return false;
+    }
+    return upstream.live == 0;
+}
+
+int
+main() {
+    std::vector<std::string> docs = {make_document(2000, 300),
+                                     make_document(10, 5),
+                                     make_document(500, 1000)};
+    ecl::json_storage js;
+    // Tokenizing more often than during the warm-up would need more room
+    // if the tokens piled up.
+    auto round = [&](const std::string &d, int tokenizes) {
+        js.reset();
+        js.read(d.data(), d.size());
+        for (int i = 0; i < tokenizes; ++i)
+            js.tokenize();
+        js.parse();
+        size_t records = js.root()["records"].size();
+        js.parse_direct();
+        if (records != js.root()["records"].size() ||
+            js.root()["wide"]["k39"].get<int64_t>() != 39)
+            return false;
+        js.reset();
+        js.read_view(d);
+        js.parse_direct();
+        return true;
+    };
+
+    for (int warmup = 0; warmup < 2; ++warmup) {
+        for (const std::string &d : docs) {
+            if (!round(d, 1))
+                return 1;
+        }
+    }
+    size_t before = allocations;
+    for (int again = 0; again < 3; ++again) {
+        for (const std::string &d : docs) {
+            if (!round(d, 3))
+                return 1;
+        }
+    }
+    size_t steady = allocations - before;
+    if (steady) {
+        std::cout << steady << " allocations in the steady state\n";
+        return 1;
+    }
+    if (!upstream_test(docs[0])) {
+        std::cout << "arena chunks not taken from, or given back to, the "
+                     "upstream\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <bits/stdc++.h>
+#include "../include/slowjson.hpp"
+
+// ndjson_batch on four threads over enough records to be cut into many
+// tasks: results in input order, every record visited once, and the error
+// of the first bad record in input order.
+
+static int failures = 0;
+
+static void
+check(bool ok, const char *what) {
+    if (!ok) {
+        std::cout << "failed: " << what << '\n';
+        ++failures;
+    }
+}
+
+// Record i, with escaped newlines and a raw one in its strings; blank lines
+// in between.
+static std::string
+make_lines(size_t count) {
+    std::string s;
+    for (size_t i = 0; i < count; ++i) {
+        s += "{\"i\":" + std::to_string(i) + ",\"s\":\"line\\nbreak " +
+             std::string(i % 50, 'x') + "\",\"raw\":\"a\nb\"}\n";
+        if (i % 97 == 0)
+            s += "\n  \t\r\n";
+    }
+    return s;
+}
+
+static std::string
+error_of(const std::function<void()> &f) {
+    try {
+        f();
+    } catch (std::exception &e) {
+        return e.what();
+    }
+    return "";
+}
+
+int
+main() {
+    const size_t count = 20000;
+    std::string text = make_lines(count);
+
+    // A raw newline inside a string does not end a record. (It is not json
+    // either, so the records parsed below leave it out.)
+    std::vector<std::string_view> records;
+    ecl::structural_index::split_records(text, records);
+    check(records.size() == count, "split_records");
+    check(records.size() > 5 && records[5].find("\"raw\":\"a\nb\"") !=
+                                    std::string_view::npos,
+          "newline inside a string");
+
+    std::string lines;
+    for (size_t i = 0; i < count; ++i) {
+        lines += "{\"i\":" + std::to_string(i) + ",\"s\":\"line\\nbreak " +
+                 std::string(i % 50, 'x') + "\"}\n";
+        if (i % 97 == 0)
+            lines += "\n  \t\r\n";
+    }
+
+    for (bool intern : {false, true}) {
+        ecl::ndjson_batch batch(4);
+        batch.set_intern_keys(intern);
+        std::vector<ecl::json_storage> docs = batch.parse(lines);
+        check(docs.size() == count && batch.size() == count, "parse() count");
+        bool ordered = true;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            const ecl::jsonobj &root = docs[i].root();
+            ordered = ordered &&
+                      root[docs[i].key("i")].get<int64_t>() == int64_t(i) &&
+                      root["s"].get<std::string>() ==
+                          "line\nbreak " + std::string(i % 50, 'x');
+        }
+        check(ordered, "parse() order");
+
+        std::vector<std::atomic<int>> seen(count);
+        std::atomic<bool> right(true);
+        batch.for_each(lines, [&](size_t i, ecl::json_storage &js) {
+            ++seen[i];
+            if (js.root()[js.key("i")].get<int64_t>() != int64_t(i))
+                right = false;
+        });
+        check(right, "for_each() index");
+        check(std::all_of(seen.begin(), seen.end(),
+                          [](const std::atomic<int> &n) { return n == 1; }),
+              "for_each() visits every record once");
+    }
+
+    // Two bad records: the one first in the input is reported, however the
+    // threads got to them.
+    std::vector<std::string> bad(count);
+    for (size_t i = 0; i < count; ++i)
+        bad[i] = "{\"i\":" + std::to_string(i) + "}\n";
+    bad[5000] = "{\"i\":1x}\n";
+    bad[15000] = "{\"i\":tru}\n";
+    std::string bad_lines;
+    for (const std::string &b : bad)
+        bad_lines += b;
+    ecl::json_storage single;
+    std::string expected = error_of([&]() {
+        single.read(bad[5000]);
+        single.parse_direct();
+    });
+    std::string later = error_of([&]() {
+        single.read(bad[15000]);
+        single.parse_direct();
+    });
+    check(!expected.empty() && expected != later, "distinct errors");
+    ecl::ndjson_batch batch(4);
+    for (int round = 0; round < 5; ++round) {
+        check(error_of([&]() { batch.parse(bad_lines); }) == expected,
+              "parse() reports the first bad record");
+        std::atomic<size_t> visited(0);
+        check(error_of([&]() {
+                  batch.for_each(bad_lines, [&](size_t, ecl::json_storage &) {
+                      ++visited;
+                  });
+              }) == expected,
+              "for_each() reports the first bad record");
+        check(visited == count - 2, "for_each() goes on past a bad record");
+    }
+
+    if (failures)
+        std::cout << failures << " failures\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+#include <bits/stdc++.h>
+#include "../include/slowjson.hpp"
+
+// Differential test: parse_parallel() on four threads must give the same
+// tree, or the same error, as parse_direct(), on documents big enough to be
+// split. Strings are full of what the splitter has to see through: escaped
+// quotes, runs of backslashes of both parities, and commas and brackets.
+
+static int failures = 0;
+
+static void
+check(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cout << "failed: " << what << '\n';
+        ++failures;
+    }
+}
+
+static std::string
+tricky_string(std::mt19937 &rng) {
+    static const char *pieces[] = {"a",      "\\\"",    "\\\\",  "\\\\\\\"",
+                                   ",",      "[",       "]",     "{",
+                                   "}",      "\\\\\\\\", ":",    "\\u00e9",
+                                   "\\n",    " , ] } ", "\\\\,", "\\\"]"};
+    std::string s = "\"";
+    for (int n = rng() % 24; n > 0; --n)
+        s += pieces[rng() % 16];
+    // A closing quote right after an even run of backslashes.
+    if (rng() % 4 == 0)
+        s += "\\\\\\\\";
+    return s + "\"";
+}
+
+static std::string
+value(std::mt19937 &rng, int depth) {
+    switch (depth > 2 ? rng() % 3 : rng() % 5) {
+    case 0:
+        return tricky_string(rng);
+    case 1:
+        return std::to_string(int(rng() % 100000) - 50000);
+    case 2:
+        return rng() % 2 ? "true" : "null";
+    case 3: {
+        std::string s = "[";
+        for (int n = rng() % 6; n > 0; --n)
+            s += value(rng, depth + 1) + (n > 1 ? "," : "");
+        return s + "]";
+    }
+    default: {
+        // Sometimes wide enough for a member_index.
+        int members = rng() % 8 ? rng() % 6 : 20 + rng() % 10;
+        std::string s = "{";
+        for (int n = members; n > 0; --n)
+            s += "\"m" + std::to_string(n) + "\":" + value(rng, depth + 1) +
+                 (n > 1 ? "," : "");
+        return s + "}";
+    }
+    }
+}
+
+// A document of at least bytes, with the offsets of its top-level commas.
+static std::string
+make_document(std::mt19937 &rng, bool object, size_t bytes,
+              std::vector<size_t> &commas) {
+    std::string s = object ? " {" : "\n[";
+    commas.clear();
+    for (size_t i = 0; s.size() < bytes; ++i) {
+        if (i) {
+            commas.push_back(s.size());
+            s += rng() % 3 ? "," : " ,\n";
+        }
+        if (object)
+            s += tricky_string(rng).insert(1, std::to_string(i) + "#") + ":";
+        s += value(rng, 0);
+    }
+    return s + (object ? "} " : "]\n");
+}
+
+static std::string
+parse(ecl::json_storage &js, const std::string &text,
+      ecl::thread_pool *pool) {
+    try {
+        js.read(text);
+        if (pool)
+            js.parse_parallel(*pool);
+        else
+            js.parse_direct();
+        return js.dump();
+    } catch (std::exception &e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+int
+main() {
+    ecl::thread_pool pool(4);
+    std::mt19937 rng(2024);
+    ecl::json_storage direct;
+    ecl::json_storage parallel;
+    for (int round = 0; round < 6; ++round) {
+        bool object = round % 2 == 0;
+        std::vector<size_t> commas;
+        std::string text =
+            make_document(rng, object, (2 << 20) + rng() % 65536, commas);
+        std::string name = (object ? "object " : "array ") +
+                           std::to_string(round);
+
+        std::string expected = parse(direct, text, nullptr);
+        check(expected.compare(0, 6, "error:") != 0, name + " parses");
+        check(parse(parallel, text, &pool) == expected, name);
+        const ecl::jsonobj &root = parallel.root();
+        check(root.type == (object ? ecl::TOP : ecl::ARRAY) &&
+                  root.size() == commas.size() + 1,
+              name + " size");
+        if (object) {
+            // The top-level object has thousands of members: look up some
+            // through its index, against the tree of parse_direct().
+            for (size_t k = 0; k < 50; ++k) {
+                const ecl::jsonobj &m =
+                    direct.root().at(rng() % (commas.size() + 1));
+                const ecl::jsonobj *found = root.find(m.name);
+                check(found && found == &root[m.name] &&
+                          found->name == direct.root()[m.name].name,
+                      name + " member lookup");
+            }
+        }
+
+        // Break the document at a top-level comma: parse_parallel() must
+        // fail like parse_direct().
+        for (const char *injected : {",,", "x", ":", "{", "\"\""}) {
+            std::string bad = text;
+            size_t at = commas[rng() % commas.size()];
+            bad.replace(at, 1, injected);
+            std::string error = parse(direct, bad, nullptr);
+            check(error.compare(0, 6, "error:") == 0,
+                  name + " injected " + injected + " fails");
+            check(parse(parallel, bad, &pool) == error,
+                  name + " injected " + injected);
+        }
+    }
+
+    // Big enough to split, but with nothing or one value to split:
+    // parse_parallel() falls back to parse_direct().
+    std::string spaces(2 << 20, ' ');
+    std::string one = "\"" + std::string(2 << 20, 'a') + "\"";
+    for (std::string text :
+         {"{" + spaces + "}", "\n[" + spaces + "]", "[" + one + "]",
+          "{\"a\":" + one + "}", "{" + spaces + "\"a\" 1}", "[" + one}) {
+        std::string expected = parse(direct, text, nullptr);
+        check(parse(parallel, text, &pool) == expected,
+              "unsplittable " + expected.substr(0, 40));
+    }
+    check(parse(parallel, "{" + spaces + "}", &pool) == "{}" &&
+              parse(parallel, "[" + spaces + "]", &pool) == "[]",
+          "empty containers");
+
+    if (failures)
+        std::cout << failures << " failures\n";
+    return failures ? 1 : 0;
+}
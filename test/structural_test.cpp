@@ -0,0 +1,225 @@
+#include <bits/stdc++.h>
+#include "../include/slowjson.hpp"
+
+// Differential test: tokenizing through the structural index must give the
+// same tokens, and the same error, as the plain scalar tokenizer, for every
+// simd level the cpu supports. Validation must give the same answer at
+// every level, and accept nothing the tokenizer rejects. Parsing in one pass
+// (through the index) must agree with feeding the text (scalar).
+
+typedef std::vector<std::pair<int, std::string>> tokens;
+
+static std::string
+run(const std::string &text, const ecl::simd_level *level, tokens &out) {
+    ecl::tokenizer t;
+    auto emit = [&out](ecl::valuetype type, std::string_view value) {
+        out.push_back({type, std::string(value)});
+        return true;
+    };
+    try {
+        ecl::structural_index index;
+        if (level && index.build(text, *level))
+            t.scan_indexed(text.data(), text.data() + text.size(),
+                           index.positions, emit);
+        else
+            t.scan(text.data(), text.data() + text.size(), emit);
+        t.finish(emit);
+    } catch (std::exception &e) {
+        return e.what();
+    }
+    return "";
+}
+
+static int failures = 0;
+
+static void
+check(const std::string &text) {
+    tokens expected;
+    std::string expected_error = run(text, nullptr, expected);
+    ecl::structural_index reference;
+    bool indexed = reference.build(text, ecl::SIMD_SCALAR);
+    ecl::json_validator validator;
+    ecl::validation_result valid = validator.validate(text, ecl::SIMD_SCALAR);
+    if (valid && !expected_error.empty()) {
+        std::cout << "validated bad json: " << text << '\n';
+        ++failures;
+    }
+    for (int l = ecl::SIMD_SCALAR; l <= ecl::structural_index::best_level();
+         ++l) {
+        ecl::simd_level level = static_cast<ecl::simd_level>(l);
+        ecl::structural_index index;
+        if (index.build(text, level) != indexed ||
+            (indexed && index.positions != reference.positions)) {
+            std::cout << "index mismatch (level " << l << "): " << text << '\n';
+            ++failures;
+        }
+        tokens got;
+        std::string error = run(text, &level, got);
+        if (got != expected || error != expected_error) {
+            std::cout << "token mismatch (level " << l << "): " << text << '\n';
+            ++failures;
+        }
+        ecl::validation_result r = validator.validate(text, level);
+        if (r.ok != valid.ok || r.offset != valid.offset ||
+            std::string(r.error) != valid.error) {
+            std::cout << "validation mismatch (level " << l << "): " << text
+                      << '\n';
+            ++failures;
+        }
+    }
+
+    // parse_direct() tokenizes through the index (once the text is long
+    // and sparse enough: the padding sees to that), feed() with the scalar
+    // scan: both must give the same tree, or the same error.
+    ecl::json_storage js;
+    std::string direct, fed;
+    try {
+        js.read(std::string(5000, ' ') + text);
+        js.parse_direct();
+        direct = js.dump();
+    } catch (std::exception &e) {
+        direct = e.what();
+    }
+    try {
+        js.feed(text.data(), text.size());
+        js.finish();
+        fed = js.dump();
+    } catch (std::exception &e) {
+        fed = e.what();
+    }
+    if (direct != fed) {
+        std::cout << "parse mismatch: " << text << '\n';
+        ++failures;
+    }
+}
+
+// What validate() must say of text, at every level: the offset of the
+// first error and its message, or ok.
+static void
+expect(const std::string &text, size_t offset, const char *error) {
+    check(text);
+    ecl::json_validator validator;
+    for (int l = ecl::SIMD_SCALAR; l <= ecl::structural_index::best_level();
+         ++l) {
+        ecl::validation_result r =
+            validator.validate(text, static_cast<ecl::simd_level>(l));
+        bool ok = error ? !r.ok && r.offset == offset &&
+                              std::string(r.error) == error
+                        : r.ok;
+        if (!ok) {
+            std::cout << "validation (level " << l << ") of " << text
+                      << ": " << (r.ok ? "ok" : r.error) << " at "
+                      << r.offset << '\n';
+            ++failures;
+        }
+    }
+}
+
+static std::string
+random_value(std::mt19937 &rng, int depth) {
+    static const char *scalars[] = {"0", "-12", "3.25", "1e5", "true",
+                                    "false", "null", "7"};
+    static const char *pieces[] = {"a", "\\\"", "\\\\", "\\n", "\\u00e9",
+                                   "{}", "[,]", ":", " ", "\\ud83d\\ude00"};
+    switch (depth > 3 ? rng() % 2 : rng() % 4) {
+    case 0:
+        return scalars[rng() % 8];
+    case 1: {
+        std::string s = "\"";
+        for (int n = rng() % 12; n > 0; --n)
+            s += pieces[rng() % 10];
+        return s + "\"";
+    }
+    case 2: {
+        std::string s = "[";
+        for (int n = rng() % 5; n > 0; --n)
+            s += random_value(rng, depth + 1) + (n > 1 ? " , " : "");
+        return s + "]";
+    }
+    default: {
+        std::string s = "{";
+        for (int n = rng() % 5; n > 0; --n)
+            s += "\n\t\"k" + std::to_string(n) + "\" :" +
+                 random_value(rng, depth + 1) + (n > 1 ? "," : "");
+        return s + "}";
+    }
+    }
+}
+
+int
+main() {
+    const char *docs[] = {
+        "{}",
+        "{\"test\":{\"noitem\":true}}",
+        "{\"a\":[1,2.5,{\"c\":null}],\"d\":false,\"e\":\"\"}",
+        "{\"esc\":\"q\\\"uo\\\\te\\\\\",\"u\":\"\\u0041\"}",
+        "{\"a\":1x}",
+        "{\"a\":tru}",
+        "{\"a\":\"unterminated}",
+        "{\"a\" \\ : 1}",
+        "{\"a\":12\r}",
+        "{\"a\":-1, \"b\" : 0.5 }   ",
+        "{\"utf8\":\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"}",
+        "{\"cut\":\"\xe2\x82\"}",
+        "{\"surrogate\":\"\xed\xa0\x80\"}",
+    };
+    for (auto d : docs)
+        check(d);
+
+    // The validator is stricter than the tokenizer: ill-formed UTF-8, raw
+    // control characters in strings and trailing content are errors.
+    const char *utf8 = "Bad Json: Bad UTF-8.\n";
+    const char *trailing = "Bad Json: Trailing content.\n";
+    expect("{\"utf8\":\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"
+           "\xf4\x8f\xbf\xbf\"}",
+           0, nullptr);
+    expect("{\"cut\":\"\xe2\x82\"}", 8, utf8);
+    expect("{\"surrogate\":\"\xed\xa0\x80\"}", 14, utf8);
+    expect("[\"\xc0\xaf\"]", 2, utf8);          // Overlong '/'
+    expect("[\"\xe0\x80\xaf\"]", 2, utf8);      // Overlong, 3 bytes
+    expect("[\"\xf0\x80\x80\xaf\"]", 2, utf8);  // Overlong, 4 bytes
+    expect("[\"\xf4\x90\x80\x80\"]", 2, utf8);  // U+110000
+    expect("[\"\xf5\x80\x80\x80\"]", 2, utf8);  // Never a lead byte
+    expect("[\"ab\x80\"]", 4, utf8);            // Lone continuation
+    expect("[\"\xc3\"]", 2, utf8);              // Cut by the quote
+    expect("[\"x\xe2\x82", 3, utf8);            // Cut by the end
+    // Sequences across the first 64-byte block boundary: a good one, one
+    // cut short, and one with a bad last byte in the next block.
+    std::string pad = "[\"" + std::string(60, 'p');
+    expect(pad + "\xe2\x82\xac\"]", 0, nullptr);
+    expect(pad + "\xe2\x82\x41\"]", 62, utf8);
+    expect(pad.substr(0, 61) + "\xf0\x9f\x98\x41\"]", 61, utf8);
+    expect(std::string(200, ' ') + pad + "\xed\xbf\xbf\"]", 262, utf8);
+
+    const char *control = "Bad Json: Bad string.\n";
+    expect("{\"a\":\"x\x01y\"}", 7, control);
+    expect("{\"a\":\"x\ty\"}", 7, control);
+    expect("[\"\x1f\"]", 2, control);
+    expect("[\"\x7f\"]", 0, nullptr);
+
+    expect("{\"a\":1} x", 8, trailing);
+    expect("{}{}", 2, trailing);
+    expect("[] ,", 3, trailing);
+    expect("{} \n\t\r", 0, nullptr);
+    expect("{\"a\":[1,2", 9, "Bad Json: Unexpected end.\n");
+    // The first error wins, whichever check finds it.
+    expect("[\"\xff\"] x", 2, utf8);
+    expect("[1] \"\xff\"", 4, trailing);
+
+    // Long documents cross many 64-byte blocks, random bytes exercise the
+    // error paths.
+    std::mt19937 rng(12345);
+    for (int i = 0; i < 2000; ++i)
+        check(random_value(rng, 0));
+    const char alphabet[] = "{}[]:,\"\\ \tabfnrtu01.-e\n";
+    for (int i = 0; i < 2000; ++i) {
+        std::string s;
+        for (int n = rng() % 200; n > 0; --n)
+            s += alphabet[rng() % (sizeof(alphabet) - 1)];
+        check(s);
+    }
+
+    if (failures)
+        std::cout << failures << " failures\n";
+    return failures ? 1 : 0;
+}
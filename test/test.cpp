@@ -1,6 +1,1224 @@
 #include <bits/stdc++.h>
 #include "../include/slowjson.hpp"
 
+struct item {
+    bool noitem = false;
+};
+struct doc {
+    item test;
+};
+SLOWJSON_BIND(item, noitem)
+SLOWJSON_BIND(doc, test)
+
+struct point {
+    int16_t x = 0;
+    uint8_t y = 0;
+};
+struct shape {
+    std::string name;
+    double scale = 1;
+    bool closed = false;
+    uint64_t id = 0;
+    std::vector<point> points;
+    std::optional<std::string> label;
+    std::optional<point> origin;
+    std::vector<std::vector<int>> grid;
+};
+SLOWJSON_BIND(point, x, y)
+SLOWJSON_BIND(shape, name, scale, closed, id, points, label, origin, grid)
+
+// Keys that are not member names.
+struct renamed {
+    int value = 0;
+    std::string text;
+};
+template <> struct ecl::json_binding<renamed> {
+    static constexpr auto
+    fields() {
+        return std::make_tuple(ecl::bind_field("the \"value\"",
+                                               &renamed::value),
+                               ecl::bind_field("tab\tkey", &renamed::text));
+    }
+};
+
+static int failures = 0;
+
+static void
+check(bool ok, const char *what) {
+    if (!ok) {
+        std::cout << "failed: " << what << '\n';
+        ++failures;
+    }
+}
+
+// Parse text into js, both from tokens and in one pass. Returns false if
+// either throws.
+static bool
+parses(ecl::json_storage &js, const std::string &text) {
+    try {
+        js.read(text);
+        js.tokenize();
+        js.parse();
+        std::string tokens = js.dump();
+        js.parse_direct();
+        return js.dump() == tokens;
+    } catch (std::runtime_error &) {
+        return false;
+    }
+}
+
+static void
+unescape_test() {
+    ecl::json_storage js;
+    check(parses(js, "{\"a\\n\\\"b\":[\"\\u00e9\",\"\\ud83d\\ude00\","
+                     "\"x\\ny\\\"z\",\"\",\"\\/\\\\\\t\"]}"),
+          "escapes parse");
+    const ecl::jsonobj &member = *js.root().begin();
+    check(member.name == "a\n\"b", "escaped member name");
+    check(member.at(0).get<std::string>() == "\xc3\xa9", "\\u00e9");
+    check(member.at(1).get<std::string>() == "\xf0\x9f\x98\x80",
+          "surrogate pair");
+    check(member.at(2).get<std::string>() == "x\ny\"z", "\\n and \\\"");
+    check(member.at(3).get<std::string>().empty(), "empty string");
+    check(member.at(4).get<std::string>() == "/\\\t", "\\/ \\\\ \\t");
+    for (const char *lone : {"[\"\\ud83d\"]", "[\"\\ude00\"]",
+                             "[\"\\ud83dx\"]", "[\"\\ud83d\\u0041\"]"})
+        check(!parses(js, lone), lone);
+}
+
+static void
+number_test() {
+    ecl::json_storage js;
+    for (const char *bad : {"[01]", "[-]", "[1.]", "[1e]", "[1e+]", "[.5]",
+                            "[+1]", "[-01]", "[1.e5]"})
+        check(!parses(js, bad), bad);
+
+    struct overflow {
+        const char *text;
+        ecl::valuetype type[3]; // By integer_overflow policy, or JSONNULL
+                                // when it throws
+    };
+    const ecl::valuetype I = ecl::INTEGER, F = ecl::FLOAT, E = ecl::JSONNULL;
+    const overflow cases[] = {
+        {"9223372036854775807", {I, I, I}},   // INT64_MAX
+        {"9223372036854775808", {I, F, E}},   // INT64_MAX + 1
+        {"18446744073709551615", {I, F, E}},  // UINT64_MAX
+        {"18446744073709551616", {F, F, E}},  // UINT64_MAX + 1
+        {"-9223372036854775808", {I, I, I}},  // INT64_MIN
+        {"-9223372036854775809", {F, F, E}},  // INT64_MIN - 1
+    };
+    for (bool lazy : {false, true}) {
+        js.set_lazy_numbers(lazy);
+        js.set_integer_overflow(ecl::OVERFLOW_UNSIGNED_OR_FLOAT);
+        check(parses(js, "[-0,1E+2,1.5e400,-2.5e-400,0.5e-3]"), "numbers");
+        const ecl::jsonobj &n = js.root();
+        check(n.at(0).type == ecl::INTEGER && n.at(0).get<int64_t>() == 0,
+              "-0");
+        check(n.at(1).get<double>() == 100, "1E+2");
+        check(n.at(2).get<double>() == HUGE_VAL, "overflow to infinity");
+        double tiny = n.at(3).get<double>();
+        check(tiny == 0 && std::signbit(tiny), "underflow to -0.0");
+        check(n.at(4).get<double>() == 0.0005, "0.5e-3");
+
+        for (const overflow &c : cases) {
+            for (int policy = 0; policy < 3; ++policy) {
+                js.set_integer_overflow(
+                    static_cast<ecl::integer_overflow>(policy));
+                std::string text = std::string("[") + c.text + "]";
+                if (c.type[policy] == E) {
+                    check(!parses(js, text), "OVERFLOW_THROW");
+                    continue;
+                }
+                if (!parses(js, text)) {
+                    check(false, c.text);
+                    continue;
+                }
+                const ecl::jsonobj &v = js.root().at(0);
+                check(v.type == c.type[policy], c.text);
+                double d = std::strtod(c.text, nullptr);
+                if (v.type == ecl::FLOAT)
+                    check(v.get<double>() == d, c.text);
+                else if (c.text[0] == '-')
+                    check(v.get<int64_t>() == std::strtoll(c.text, nullptr, 10),
+                          c.text);
+                else
+                    check(v.get<uint64_t>() ==
+                              std::strtoull(c.text, nullptr, 10),
+                          c.text);
+            }
+        }
+    }
+}
+
+template <typename Exception, typename F>
+static bool
+throws(F &&f) {
+    try {
+        f();
+    } catch (Exception &) {
+        return true;
+    }
+    return false;
+}
+
+// Objects with at least index_threshold members are looked up through a
+// member_index; the first of duplicate names wins either way.
+static void
+accessor_test() {
+    std::string text = "{\"k5\":\"first\"";
+    for (int i = 0; i < 40; ++i)
+        text += ",\"k" + std::to_string(i) + "\":" + std::to_string(i);
+    text += ",\"arr\":[1,\"s\",true]}";
+    for (size_t threshold : {16, 0}) {
+        ecl::json_storage js;
+        js.set_index_threshold(threshold);
+        check(parses(js, text), "wide object");
+        const ecl::jsonobj &root = js.root();
+        check(root.size() == 42, "size");
+        check(root["k5"].get<std::string>() == "first", "duplicate name");
+        check(root["k39"].get<int64_t>() == 39, "last member");
+        check(root.find("k40") == nullptr, "missing member");
+        check(root.at(1).name == "k0" && root.at(41).name == "arr", "at()");
+        const ecl::jsonobj &arr = root["arr"];
+        check(arr.at(1).get<std::string_view>() == "s", "element");
+        check(throws<std::out_of_range>([&]() { root["nope"]; }),
+              "operator[] on a missing member");
+        check(throws<std::out_of_range>([&]() { arr.at(3); }),
+              "at() past the end");
+        check(throws<std::runtime_error>([&]() { arr.at(0).get<bool>(); }),
+              "get<bool>() of an integer");
+        check(throws<std::runtime_error>(
+                  [&]() { arr.at(1).get<int64_t>(); }),
+              "get<int64_t>() of a string");
+        check(throws<std::runtime_error>([&]() { arr.at(2).get<double>(); }),
+              "get<double>() of a boolean");
+        check(throws<std::runtime_error>(
+                  [&]() { root["k1"].get<std::string>(); }),
+              "get<std::string>() of an integer");
+    }
+}
+
+// Lookups by interned_key compare ids only against a tree interned in the
+// pool the key was looked up in, and names otherwise.
+static void
+key_pool_test() {
+    auto pool = std::make_shared<ecl::key_pool>();
+    ecl::json_storage a;
+    ecl::json_storage b;
+    ecl::json_storage plain;
+    a.set_key_pool(pool);
+    b.set_key_pool(std::make_shared<ecl::key_pool>());
+    // Looked up before any parse interned the name.
+    ecl::interned_key early = a.key("y");
+    check(early.id == ecl::interned_key::absent, "key before interning");
+    check(parses(a, "{\"x\":1,\"y\":2}"), "object with a pool");
+    check(parses(b, "{\"y\":3,\"x\":4}"), "object with another pool");
+    check(parses(plain, "{\"x\":5,\"y\":6}"), "object without a pool");
+    check(pool->size() == 2 && a.key("x").id == 1, "interned names");
+
+    check(a.root()[early].get<int64_t>() == 2, "key from before the parse");
+    check(a.root()[a.key("x")].get<int64_t>() == 1, "key of the same pool");
+    // Id 1 is x in one pool and y in the other.
+    check(b.root()[a.key("x")].get<int64_t>() == 4, "key of another pool");
+    check(a.root()[b.key("x")].get<int64_t>() == 1, "key of another pool");
+    check(plain.root()[a.key("y")].get<int64_t>() == 6, "key on no pool");
+    check(a.root()[plain.key("y")].get<int64_t>() == 2, "key without pool");
+    check(a.root().find(a.key("z")) == nullptr, "missing key");
+    check(a.root()[a.key("x")].name.data() == pool->name(1).data(),
+          "pooled name");
+
+    // A second storage sharing the pool sees the names of the first.
+    ecl::json_storage shared;
+    shared.set_key_pool(pool);
+    ecl::interned_key z = shared.key("z");
+    check(parses(shared, "{\"z\":7,\"x\":8}"), "object in a shared pool");
+    check(shared.root()[z].get<int64_t>() == 7 &&
+              shared.root()[a.key("x")].get<int64_t>() == 8,
+          "keys of a shared pool");
+    check(a.root().find(shared.key("z")) == nullptr, "missing shared key");
+}
+
+template <typename T>
+static void
+decode(T &out, const std::string &text) {
+    ecl::json_storage js;
+    js.read(text);
+    js.parse_into(out);
+}
+
+// What parse_into() throws on text, or "" if it does not.
+template <typename T>
+static std::string
+decode_error(const std::string &text) {
+    try {
+        T out;
+        decode(out, text);
+    } catch (std::runtime_error &e) {
+        return e.what();
+    }
+    return "";
+}
+
+static void
+bind_test() {
+    std::string text =
+        "{\"name\":\"tri\\\"angle\",\"scale\":2.5,\"closed\":true,"
+        "\"id\":18446744073709551615,\"points\":[{\"x\":-32768,\"y\":255},"
+        "{\"x\":32767,\"y\":0}],\"label\":\"l\",\"origin\":{\"x\":1,"
+        "\"y\":2},\"grid\":[[1,2],[],[3]]}";
+    shape s;
+    decode(s, text);
+    check(s.name == "tri\"angle" && s.scale == 2.5 && s.closed &&
+              s.id == UINT64_MAX,
+          "bound scalars");
+    check(s.points.size() == 2 && s.points[0].x == -32768 &&
+              s.points[0].y == 255 && s.points[1].x == 32767,
+          "bound vector of structs");
+    check(s.label == std::optional<std::string>("l") && s.origin &&
+              s.origin->x == 1 && s.origin->y == 2,
+          "bound optionals");
+    check(s.grid == std::vector<std::vector<int>>{{1, 2}, {}, {3}},
+          "bound nested vectors");
+
+    // Written back, it reads as the same document, in either layout.
+    ecl::json_storage js;
+    js.read(text);
+    js.parse_direct();
+    check(ecl::to_json(s) == js.dump(), "to_json");
+    shape again;
+    decode(again, ecl::to_json(s, 4));
+    check(ecl::to_json(again) == js.dump(), "to_json re-parsed");
+
+    // Arrays replace what a vector held, null resets an optional, and
+    // absent members keep their value.
+    decode(s, "{\"points\":[{\"x\":7}],\"label\":null,\"grid\":[]}");
+    check(s.points.size() == 1 && s.points[0].x == 7 && s.points[0].y == 0,
+          "vector cleared");
+    check(!s.label && s.origin && s.grid.empty(), "optional reset by null");
+    check(s.name == "tri\"angle" && s.id == UINT64_MAX, "absent members kept");
+
+    // Unknown keys are skipped with whatever they hold.
+    shape u;
+    decode(u, "{\"extra\":{\"name\":[1,{\"id\":[]}],\"x\":\"d\"},"
+              "\"more\":[[1],{\"name\":2}],\"name\":\"n\","
+              "\"origin\":{\"z\":{\"x\":[9]},\"x\":3},\"end\":null}");
+    check(u.name == "n" && u.origin && u.origin->x == 3 && u.points.empty(),
+          "unknown keys skipped");
+
+    for (const char *bad :
+         {"{\"points\":[{\"y\":256}]}", "{\"points\":[{\"y\":-1}]}",
+          "{\"points\":[{\"x\":32768}]}", "{\"points\":[{\"x\":-32769}]}",
+          "{\"id\":-1}", "{\"grid\":[[2147483648]]}"})
+        check(decode_error<shape>(bad) == "Bad type.\n", "out of range");
+    for (const char *bad :
+         {"{\"name\":1}", "{\"closed\":\"yes\"}", "{\"points\":{}}",
+          "{\"scale\":\"1\"}", "{\"id\":1.5}", "{\"origin\":[]}",
+          "{\"name\":null}", "[]"})
+        check(decode_error<shape>(bad) == "Bad type.\n", "mismatched type");
+
+    // Keys of a hand-written binding, matched once unescaped.
+    renamed r;
+    decode(r, "{\"the \\\"value\\\"\":5,\"tab\\u0009key\":\"t\","
+              "\"value\":6}");
+    check(r.value == 5 && r.text == "t", "escaped keys");
+    check(ecl::to_json(r) == "{\"the \\\"value\\\"\":5,\"tab\\tkey\":\"t\"}",
+          "escaped keys written");
+}
+
+// Offsets of a known tape, and load_tape() giving the tree of
+// parse_direct().
+static void
+tape_test() {
+    ecl::json_storage js;
+    js.read(std::string("{\"a\":[1,2.5,{\"b\":true}],\"c\":{},\"d\":\"s\","
+                        "\"e\":[],\"f\":18446744073709551615}"));
+    ecl::json_tape tape;
+    js.parse_tape(tape);
+    // 0 { 1 "a" 2 [ 3 1 5 2.5 7 { 8 "b" 9 true 10 } 11 ] 12 "c" 13 { 14 }
+    // 15 "d" 16 "s" 17 "e" 18 [ 19 ] 20 "f" 21 uint64 23 }
+    check(tape.size() == 24 && tape.type(0) == ecl::OBJECT &&
+              tape.next(0) == 24 && tape.count(0) == 5 && tape.match(0) == 23,
+          "tape top level");
+    check(tape.type(2) == ecl::ARRAY && tape.count(2) == 3 &&
+              tape.first_child(2) == 3 && tape.next(2) == 12 &&
+              tape.match(2) == 11 && tape.match(11) == 2,
+          "tape array");
+    check(tape.next(3) == 5 && tape.get_int64(3) == 1 && !tape.is_unsigned(3),
+          "tape integer");
+    check(tape.type(5) == ecl::FLOAT && tape.next(5) == 7 &&
+              tape.get_double(5) == 2.5,
+          "tape float");
+    check(tape.type(7) == ecl::OBJECT && tape.count(7) == 1 &&
+              tape.next(7) == 11 && tape.match(10) == 7 &&
+              tape.get_string(8) == "b" && tape.get_bool(9),
+          "tape nested object");
+    check(tape.first_child(13) == 14 && tape.match(13) == 14 &&
+              tape.count(13) == 0 && tape.type(14) == ecl::RBRACE &&
+              tape.next(13) == 15,
+          "tape empty object");
+    check(tape.get_string(15) == "d" && tape.get_string(16) == "s" &&
+              tape.next(16) == 17,
+          "tape strings");
+    check(tape.count(18) == 0 && tape.type(19) == ecl::RBRACKET &&
+              tape.next(18) == 20,
+          "tape empty array");
+    check(tape.is_unsigned(21) && tape.get_uint64(21) == UINT64_MAX &&
+              tape.next(21) == 23 && tape.type(23) == ecl::RBRACE,
+          "tape unsigned");
+    // Skipping from member to member never enters a container.
+    std::vector<size_t> members;
+    for (size_t i = tape.first_child(0); i != tape.match(0);
+         i = tape.next(i + 1))
+        members.push_back(i);
+    check(members == std::vector<size_t>{1, 12, 15, 17, 20}, "tape skips");
+
+    std::string text = "[";
+    for (int i = 0; i < 300; ++i)
+        text += "{\"k\\u00e9\":[" + std::to_string(i) + ",-" +
+                std::to_string(i) + ".5,\"v\\n\",null,false,{}]},";
+    text += "\"\",18446744073709551615,-9223372036854775808]";
+    check(parses(js, text), "tape document");
+    js.parse_tape(tape);
+    ecl::json_storage loaded;
+    loaded.load_tape(tape);
+    check(loaded.dump() == js.dump() && tape.count(0) == 303,
+          "load_tape round trip");
+}
+
+// Records events as text, and stops the parse after stop_after of them.
+struct event_log : ecl::sax_handler {
+    std::vector<std::string> events;
+    size_t stop_after = SIZE_MAX;
+
+    bool
+    add(std::string e) {
+        events.push_back(std::move(e));
+        return events.size() < stop_after;
+    }
+
+    bool start_object() { return add("{"); }
+    bool end_object() { return add("}"); }
+    bool start_array() { return add("["); }
+    bool end_array() { return add("]"); }
+    bool key(std::string_view k) { return add("k:" + std::string(k)); }
+    bool string(std::string_view s) { return add("s:" + std::string(s)); }
+    bool int64(int64_t i) { return add("i:" + std::to_string(i)); }
+    bool uint64(uint64_t u) { return add("u:" + std::to_string(u)); }
+    bool float64(double d) { return add("d:" + std::to_string(d)); }
+    bool boolean(bool b) { return add(b ? "true" : "false"); }
+    bool null() { return add("null"); }
+};
+
+// parse_sax() hands every event in order, and a handler returning false
+// stops it there: nothing arrives after, and it returns false. Replaying a
+// tree or a tape stops the same way.
+static void
+sax_test() {
+    ecl::json_storage js;
+    js.read(std::string("{\"a\":[1,-2.5,\"x\\ty\"],\"b\":{\"c\":null,"
+                        "\"d\":true},\"e\":[],\"f\":18446744073709551615}"));
+    const std::vector<std::string> all = {
+        "{",   "k:a", "[",    "i:1", "d:-2.500000", "s:x\ty", "]",
+        "k:b", "{",   "k:c",  "null", "k:d",        "true",    "}",
+        "k:e", "[",   "]",    "k:f", "u:18446744073709551615", "}"};
+    event_log log;
+    check(js.parse_sax(log) && log.events == all, "sax events");
+    js.parse_direct();
+    ecl::json_tape tape;
+    js.parse_tape(tape);
+    for (size_t stop = 1; stop <= all.size(); ++stop) {
+        std::vector<std::string> head(all.begin(), all.begin() + stop);
+        event_log sax, tree, taped;
+        sax.stop_after = tree.stop_after = taped.stop_after = stop;
+        check(!js.parse_sax(sax) && sax.events == head, "sax stopped");
+        check(!js.root().walk(tree) && tree.events == head,
+              "tree walk stopped");
+        check(!tape.walk(taped) && taped.events == head, "tape walk stopped");
+    }
+    // A stopped parse leaves nothing behind for the next one.
+    log.events.clear();
+    check(js.parse_sax(log) && log.events == all, "sax after a stop");
+}
+
+// compact_tree: 16-byte nodes, strings of up to 8 bytes inline, and the
+// accessors of jsonobj over them.
+static void
+compact_test() {
+    check(sizeof(ecl::compact_tree::node) == 16, "compact node size");
+    std::string text =
+        "{\"s8\":\"12345678\",\"s9\":\"123456789\","
+        "\"e8\":\"\\u00e9\\n\\\"123\\t\",\"e9\":\"\\u00e9\\n\\\"1234\\t\","
+        "\"empty\":\"\",\"u\":18446744073709551615,"
+        "\"i\":-9223372036854775808,\"d\":-0.125,\"b\":false,\"n\":null,"
+        "\"a\":[1,[2,3],{\"x\":\"y\"},[]],\"o\":{},\"s8\":\"dup\"}";
+    ecl::json_storage js;
+    check(parses(js, text), "compact document");
+    ecl::compact_tree tree;
+    js.parse_compact(tree);
+    ecl::compact_value root = tree.root();
+    check(root.type() == ecl::TOP && root.size() == 13, "compact root");
+
+    // The exact boundary of inline strings, counted after unescaping.
+    const std::pair<const char *, std::string> strings[] = {
+        {"s8", "12345678"},
+        {"s9", "123456789"},
+        {"e8", "\xc3\xa9\n\"123\t"},
+        {"e9", "\xc3\xa9\n\"1234\t"},
+        {"empty", ""}};
+    for (const auto &s : strings) {
+        ecl::compact_value v = root[s.first];
+        check(v.type() == ecl::STRING && v.get<std::string>() == s.second,
+              "compact string");
+    }
+    size_t inline_count = 0;
+    size_t long_count = 0;
+    for (const ecl::compact_tree::node &n : tree.nodes) {
+        if (n.type != ecl::STRING)
+            continue;
+        if (n.length == ecl::compact_tree::long_string)
+            ++long_count;
+        else
+            ++inline_count;
+    }
+    // s8, e8, empty, "y" and the duplicate inline; s9 and e9 out of line.
+    check(inline_count == 5 && long_count == 2 &&
+              tree.strings == "123456789\xc3\xa9\n\"1234\t",
+          "inline strings up to 8 bytes");
+
+    check(root["u"].get<uint64_t>() == UINT64_MAX &&
+              root["i"].get<int64_t>() == INT64_MIN &&
+              root["d"].get<double>() == -0.125 && !root["b"].get<bool>() &&
+              root["n"].type() == ecl::JSONNULL,
+          "compact payloads");
+    check(throws<std::runtime_error>([&]() { root["u"].get<int64_t>(); }),
+          "compact uint64 as int64");
+    check(root["s8"].get<std::string>() == "12345678", "compact duplicate");
+    check(!root.find("nope") && !root["a"].find("x"), "compact find misses");
+    check(throws<std::out_of_range>([&]() { root["nope"]; }) &&
+              throws<std::out_of_range>([&]() { root["a"].at(4); }),
+          "compact misses throw");
+
+    ecl::compact_value a = root["a"];
+    check(a.type() == ecl::ARRAY && a.size() == 4 &&
+              a.at(1).at(1).get<int64_t>() == 3 &&
+              a.at(2)["x"].get<std::string>() == "y" &&
+              a.at(3).size() == 0 && root["o"].size() == 0,
+          "compact at and size");
+    std::vector<std::string> names;
+    for (ecl::compact_value m : root)
+        names.push_back(std::string(m.name()));
+    check(names == std::vector<std::string>{"s8", "s9", "e8", "e9", "empty",
+                                            "u", "i", "d", "b", "n", "a", "o",
+                                            "s8"},
+          "compact iteration");
+    size_t elements = 0;
+    for (ecl::compact_value e : a)
+        elements += e.name().empty();
+    check(elements == 4, "compact elements have no name");
+
+    // Written back, it is the document of the tree, in both layouts.
+    for (int indent : {0, 2}) {
+        std::string out;
+        ecl::json_writer w(out, indent);
+        check(tree.walk(w) && out == js.dump(indent), "compact walk");
+    }
+}
+
+#ifdef SLOWJSON_STATS
+// Exact counts of a known document, through each kind of parse.
+static void
+stats_test() {
+    std::string text = "{\"a\":[1,2.5,\"s\",true,null,-3],"
+                       "\"b\":{\"c\":false,\"d\":[]}}";
+    ecl::json_storage js;
+    js.read(text);
+    js.parse_direct();
+    ecl::parse_stats once = js.stats();
+    using ecl::parse_stats;
+    uint64_t tokens[ecl::JSONNULL + 1] = {};
+    tokens[ecl::LBRACE] = tokens[ecl::RBRACE] = 2;
+    tokens[ecl::LBRACKET] = tokens[ecl::RBRACKET] = 2;
+    tokens[ecl::COMMA] = 7;
+    tokens[ecl::COLON] = 4;
+    tokens[ecl::STRING] = 5; // Four names and "s"
+    tokens[ecl::INTEGER] = 2;
+    tokens[ecl::FLOAT] = 1;
+    tokens[ecl::BOOLEAN] = 2;
+    tokens[ecl::JSONNULL] = 1;
+    check(std::equal(tokens, tokens + ecl::JSONNULL + 1, once.tokens),
+          "token counts");
+    check(once.nodes == 10 && once.max_depth == 3, "node count and depth");
+    check(once.calls[parse_stats::PHASE_READ] == 1 &&
+              once.calls[parse_stats::PHASE_TOKENIZE] == 0 &&
+              once.calls[parse_stats::PHASE_PARSE] == 1 &&
+              once.bytes[parse_stats::PHASE_READ] == text.size() &&
+              once.bytes[parse_stats::PHASE_PARSE] == text.size(),
+          "calls and bytes");
+
+    // tokenize() counts the tokens, parse() from them only the nodes.
+    js.tokenize();
+    js.parse();
+    const parse_stats &twice = js.stats();
+    bool doubled = twice.nodes == 20 && twice.max_depth == 3 &&
+                   twice.calls[parse_stats::PHASE_TOKENIZE] == 1 &&
+                   twice.calls[parse_stats::PHASE_PARSE] == 2;
+    for (int t = 0; t <= ecl::JSONNULL; ++t)
+        doubled = doubled && twice.tokens[t] == 2 * tokens[t];
+    check(doubled, "counts of tokenize() and parse()");
+
+    parse_stats sum = once;
+    sum += once;
+    sum.max_depth = 0;
+    sum += parse_stats();
+    bool summed = sum.nodes == 20 && sum.max_depth == 0 &&
+                  sum.calls[parse_stats::PHASE_PARSE] == 2 &&
+                  sum.bytes[parse_stats::PHASE_READ] == 2 * text.size() &&
+                  sum.nanoseconds[parse_stats::PHASE_PARSE] ==
+                      2 * once.nanoseconds[parse_stats::PHASE_PARSE] &&
+                  sum.allocations == 2 * once.allocations;
+    for (int t = 0; t <= ecl::JSONNULL; ++t)
+        summed = summed && sum.tokens[t] == 2 * tokens[t];
+    sum += once;
+    check(summed && sum.max_depth == 3, "operator+=");
+
+    js.reset_stats();
+    const parse_stats &zero = js.stats();
+    bool cleared = zero.nodes == 0 && zero.max_depth == 0 &&
+                   zero.allocations == 0 && zero.allocated_bytes == 0;
+    for (int p = 0; p < parse_stats::PHASE_COUNT; ++p)
+        cleared = cleared && zero.calls[p] == 0 && zero.nanoseconds[p] == 0 &&
+                  zero.bytes[p] == 0;
+    for (int t = 0; t <= ecl::JSONNULL; ++t)
+        cleared = cleared && zero.tokens[t] == 0;
+    check(cleared, "reset_stats()");
+    js.parse_direct();
+    check(js.stats().nodes == 10 &&
+              js.stats().calls[parse_stats::PHASE_PARSE] == 1,
+          "counts after reset_stats()");
+}
+#endif
+
+// feed() must give the same tree wherever the document is cut: inside
+// strings, escapes, numbers and literals.
+static void
+feed_test() {
+    std::string text = "{\"s\":\"a\\\"b\\u00e9\\ud83d\\ude00\\n\","
+                       "\"n\":[-12.5e+3,0,123456],\"l\":[true,false,null],"
+                       "\"e\":{},\"k\\t\":\"\"}";
+    ecl::json_storage expected;
+    expected.read(text);
+    expected.parse_direct();
+    std::string want = expected.dump();
+
+    ecl::json_storage js;
+    for (size_t cut = 0; cut <= text.size(); ++cut) {
+        js.feed(text.data(), cut);
+        js.feed(text.data() + cut, text.size() - cut);
+        js.finish();
+        check(js.dump() == want, "feed() in two pieces");
+        if (cut == text.size())
+            continue;
+        // A document cut short is incomplete.
+        js.feed(text.data(), cut);
+        check(throws<std::runtime_error>([&]() { js.finish(); }),
+              "finish() of a truncated document");
+    }
+    for (char c : text)
+        js.feed(&c, 1);
+    js.finish();
+    check(js.dump() == want, "feed() byte by byte");
+
+    // An error drops the document; the next feed() starts a new one.
+    check(throws<std::runtime_error>([&]() { js.feed("{\"a\":tru ", 9); }),
+          "feed() of a bad literal");
+    js.feed(text.data(), text.size());
+    js.finish();
+    check(js.dump() == want, "feed() after an error");
+}
+
+static void
+lazy_test() {
+    ecl::json_storage js;
+    js.read(std::string(
+        "{\"skip\":{\"x\":\"a\\\"}]{[\\\\\",\"y\":[1,{\"z\":\"]\"}]},"
+        "\"a\\u00e9b\":[1,[2,3],{\"q\":true}],\"num\":-1.5e2,\"s\":\"v\","
+        "\"n\":null}"));
+    const std::string escaped = "a\xc3\xa9" "b";
+    ecl::lazy_value root = js.parse_lazy();
+    check(root.type() == ecl::TOP && root.size() == 5, "lazy size");
+    std::vector<std::string> names;
+    for (ecl::lazy_value member : root)
+        names.push_back(std::string(member.name()));
+    check(names == std::vector<std::string>{"skip", escaped, "num", "s", "n"},
+          "lazy member names");
+
+    // Passing over "skip" must not be fooled by the quotes and brackets in
+    // its strings.
+    check(root["s"].get<std::string>() == "v", "lazy skip");
+    check(root["skip"]["x"].get<std::string>() == "a\"}]{[\\", "lazy string");
+    check(root["skip"]["y"].at(1)["z"].get<std::string>() == "]",
+          "lazy nested string");
+    check(root.at(1).name_is(escaped), "name_is() of an escaped name");
+    check(!root.at(1).name_is("a\\u00e9b"), "name_is() of the raw name");
+    ecl::lazy_value arr = root[escaped];
+    check(arr.type() == ecl::ARRAY && arr.size() == 3, "lazy array");
+    check(arr.at(0).type() == ecl::INTEGER && arr.at(0).get<int64_t>() == 1,
+          "lazy integer");
+    check(arr.at(1).at(1).get<int64_t>() == 3, "lazy nested array");
+    check(arr.at(2)["q"].get<bool>(), "lazy boolean");
+    check(root["num"].type() == ecl::FLOAT &&
+              root["num"].get<double>() == -150,
+          "lazy float");
+    check(root["n"].type() == ecl::JSONNULL, "lazy null");
+    check(!root.find("missing") && !arr.find("q"), "lazy find() misses");
+
+    // An escaped string or name is decoded once; reading it again gives the
+    // same bytes rather than another copy.
+    ecl::lazy_value x = root["skip"]["x"];
+    std::string_view first_value = x.get<std::string_view>();
+    std::string_view first_name = root.at(1).name();
+    bool same_bytes = true;
+    for (int i = 0; i < 1000; ++i) {
+        same_bytes &= x.get<std::string_view>().data() == first_value.data();
+        same_bytes &= root.at(1).name().data() == first_name.data();
+        same_bytes &= root.at(1).name_is(escaped);
+    }
+    check(same_bytes && first_value == "a\"}]{[\\" && first_name == escaped,
+          "lazy escaped strings decoded once");
+
+    check(throws<std::out_of_range>([&]() { root["missing"]; }),
+          "lazy operator[] on a missing member");
+    check(throws<std::out_of_range>([&]() { arr.at(3); }),
+          "lazy at() past the end");
+    check(throws<std::runtime_error>([&]() { root["s"].get<int64_t>(); }),
+          "lazy get<int64_t>() of a string");
+    check(throws<std::runtime_error>(
+              [&]() { root["skip"].get<std::string>(); }),
+          "lazy get<std::string>() of an object");
+    check(throws<std::runtime_error>([&]() { root["n"].get<bool>(); }),
+          "lazy get<bool>() of null");
+}
+
+// Lazy numbers of one tree read from several threads at once, each number
+// for the first time, give what an eager parse gives.
+static void
+lazy_numbers_test() {
+    std::string text = "[";
+    for (int i = 0; i < 20000; ++i) {
+        text += i ? "," : "";
+        text += i % 3 == 0   ? std::to_string(i * 1000003LL - 7)
+                : i % 3 == 1 ? std::to_string(i) + ".25e-3"
+                             : std::to_string(UINT64_MAX - i);
+    }
+    text += "]";
+    ecl::json_storage eager;
+    eager.read(text);
+    eager.parse_direct();
+    ecl::json_storage lazy;
+    lazy.set_lazy_numbers(true);
+    lazy.read(text);
+    lazy.parse_direct();
+
+    std::vector<const ecl::jsonobj *> want;
+    std::vector<const ecl::jsonobj *> got;
+    for (const ecl::jsonobj &n : eager.root())
+        want.push_back(&n);
+    for (const ecl::jsonobj &n : lazy.root())
+        got.push_back(&n);
+    std::atomic<size_t> wrong(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            for (int pass = 0; pass < 2; ++pass) {
+                for (size_t i = 0; i < got.size(); ++i) {
+                    if (got[i]->number() != want[i]->obj)
+                        ++wrong;
+                }
+            }
+        });
+    }
+    for (std::thread &t : readers)
+        t.join();
+    check(got.size() == 20000 && wrong == 0, "lazy numbers on threads");
+}
+
+// Whether a lazy value holds what a node of the tree does.
+static bool
+same(const ecl::lazy_value &v, const ecl::jsonobj &n) {
+    if (v.type() != n.type)
+        return false;
+    switch (n.type) {
+    case ecl::TOP:
+    case ecl::OBJECT:
+    case ecl::ARRAY: {
+        if (v.size() != n.size())
+            return false;
+        ecl::lazy_value::iterator i = v.begin();
+        for (const ecl::jsonobj &c : n) {
+            if ((n.type != ecl::ARRAY && (*i).name() != c.name) ||
+                !same(*i, c))
+                return false;
+            ++i;
+        }
+        return true;
+    }
+    case ecl::STRING:
+        return v.get<std::string>() == n.get<std::string>();
+    case ecl::INTEGER:
+        return v.get<int64_t>() == n.get<int64_t>();
+    case ecl::FLOAT:
+        return v.get<double>() == n.get<double>();
+    case ecl::BOOLEAN:
+        return v.get<bool>() == n.get<bool>();
+    default:
+        return true;
+    }
+}
+
+// The nodes at pointer in the tree, in document order, found a segment at
+// a time with find() and at().
+static void
+resolve(const ecl::jsonobj &n, std::string_view pointer,
+        std::vector<const ecl::jsonobj *> &out) {
+    if (pointer.empty()) {
+        out.push_back(&n);
+        return;
+    }
+    pointer.remove_prefix(1);
+    size_t end = std::min(pointer.find('/'), pointer.size());
+    std::string segment;
+    for (size_t i = 0; i < end; ++i) {
+        if (pointer[i] == '~')
+            segment += pointer[++i] == '0' ? '~' : '/';
+        else
+            segment += pointer[i];
+    }
+    std::string_view rest = pointer.substr(end);
+    bool container = n.type == ecl::TOP || n.type == ecl::OBJECT ||
+                     n.type == ecl::ARRAY;
+    if (segment == "*" && container) {
+        for (const ecl::jsonobj &c : n)
+            resolve(c, rest, out);
+    } else if (n.type == ecl::ARRAY) {
+        char *last;
+        size_t index = strtoul(segment.c_str(), &last, 10);
+        if (!segment.empty() && !*last && isdigit(segment[0]) &&
+            (segment == "0" || segment[0] != '0') && index < n.size())
+            resolve(n.at(index), rest, out);
+    } else if (container) {
+        if (const ecl::jsonobj *c = n.find(segment))
+            resolve(*c, rest, out);
+    }
+}
+
+// path_query against the tree of parse_direct(): wildcards, escaped and
+// numeric segments, shared prefixes, duplicate names and paths that match
+// nothing, with one result list reused across documents.
+static void
+query_test() {
+    const char *pointers[] = {
+        "",           "/a/b/*/c", "/a/b/0/d",   "/a/b",     "/a/b2/c",
+        "/a/*/c",     "/m~1n/~0k", "/dup",      "/arr/1/1/0", "/arr/*/0",
+        "/arr/2",     "/w/*/c",   "/w/*/0/c",   "/nope",    "/a/b/9",
+        "/a/b/01",    "/*",       "/esc\"q",    "/",        "/arr/-",
+        "/a/b/*/e/*", "/*/*/*",   "/dup/x",     "/a/b/1/c", "/~01"};
+    ecl::path_query q;
+    const size_t count = sizeof(pointers) / sizeof(pointers[0]);
+    for (size_t p = 0; p < count; ++p)
+        check(q.add(pointers[p]) == p, "path numbers");
+    check(throws<std::runtime_error>([&]() { q.add("a"); }) &&
+              throws<std::runtime_error>([&]() { q.add("/~2"); }) &&
+              throws<std::runtime_error>([&]() { q.add("/a~"); }) &&
+              q.size() == count,
+          "bad pointers");
+
+    const char *documents[] = {
+        "{\"a\":{\"b\":[{\"c\":1,\"d\":\"x\"},{\"c\":2},{\"e\":[true,null]}],"
+        "\"b2\":{\"c\":3}},\"m/n\":{\"~k\":\"tilde\",\"k\":0},\"dup\":1,"
+        "\"dup\":{\"x\":2},\"arr\":[[1,2],[3,[4,5]],\"s\"],\"w\":{\"p\":"
+        "{\"c\":\"deep\"},\"q\":[{\"c\":4.5}],\"r\":{\"c\":null}},"
+        "\"esc\\\"q\":7,\"\":\"empty\",\"~1\":\"not a slash\"}",
+        "[{\"a\":1},[\"b\"],{\"dup\":[0]}]",
+        "{\"w\":[{\"c\":1},{\"c\":[{\"c\":2}]}],\"a\":{\"b\":{\"0\":{\"d\":"
+        "\"object, not array\"},\"1\":{\"c\":3}}},\"*\":\"star\"}"};
+    std::vector<std::vector<ecl::lazy_value>> results;
+    ecl::json_storage lazy;
+    ecl::json_storage tree;
+    for (const char *d : documents) {
+        std::string text = d;
+        check(parses(tree, text), "query document");
+        lazy.read(text);
+        q.match(lazy.parse_lazy(), results);
+        check(results.size() == q.size(), "a result list per path");
+        for (size_t p = 0; p < q.size(); ++p) {
+            std::vector<const ecl::jsonobj *> want;
+            resolve(tree.root(), pointers[p], want);
+            bool ok = results[p].size() == want.size();
+            for (size_t i = 0; ok && i < want.size(); ++i)
+                ok = same(results[p][i], *want[i]);
+            check(ok, (std::string("query ") + pointers[p]).c_str());
+        }
+    }
+    // Spot checks of the reference itself, on the first document.
+    lazy.read(std::string(documents[0]));
+    std::vector<std::vector<ecl::lazy_value>> first = lazy.query(q);
+    check(first[1].size() == 2 && first[1][1].get<int64_t>() == 2,
+          "wildcard over an array");
+    check(first[6].size() == 1 && first[6][0].get<std::string>() == "tilde",
+          "escaped segments");
+    check(first[7].size() == 1 && first[7][0].type() == ecl::INTEGER,
+          "first duplicate wins");
+    check(first[8].size() == 1 && first[8][0].get<int64_t>() == 4,
+          "numeric segments");
+    check(first[11].size() == 2 &&
+              first[11][0].get<std::string>() == "deep" &&
+              first[11][1].type() == ecl::JSONNULL,
+          "wildcard over an object");
+    check(first[13].empty() && first[14].empty() && first[15].empty() &&
+              first[19].empty() && first[22].empty(),
+          "paths that match nothing");
+    check(first[18].size() == 1 && first[18][0].get<std::string>() == "empty",
+          "empty name");
+    check(first[24].size() == 1 &&
+              first[24][0].get<std::string>() == "not a slash",
+          "~01 is ~1");
+}
+
+// A new file in the temporary directory holding content. The caller
+// removes it.
+static std::string
+temporary_file(const std::string &content) {
+    std::string path =
+        (std::filesystem::temp_directory_path() / "slowjson_test_").string();
+#ifdef SLOWJSON_HAS_MMAP
+    path += "XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd >= 0)
+        close(fd);
+#else
+    path += std::to_string(std::random_device()());
+#endif
+    std::ofstream(path, std::ios::binary) << content;
+    return path;
+}
+
+// parse_compressed_file() reads plain and gzip files in small chunks; a
+// gzip file cut short or corrupted throws.
+static void
+compressed_test() {
+    std::string text = "{\"a\":[";
+    for (int i = 0; i < 2000; ++i)
+        text += (i ? ",\"" : "\"") + std::to_string(i * 7919) + "\"";
+    text += "]}";
+    ecl::json_storage expected;
+    expected.read(text);
+    expected.parse_direct();
+
+    ecl::json_storage js;
+    std::string path = temporary_file(text);
+    js.parse_compressed_file(path, 16);
+    check(js.dump() == expected.dump(), "parse_compressed_file of text");
+#ifdef SLOWJSON_ZLIB
+    gzFile gz = gzopen(path.c_str(), "wb");
+    gzwrite(gz, text.data(), static_cast<unsigned>(text.size()));
+    gzclose(gz);
+    std::ifstream in(path, std::ios::binary);
+    std::string packed((std::istreambuf_iterator<char>(in)),
+                       std::istreambuf_iterator<char>());
+    in.close();
+    check(packed.size() > 20 && packed[0] == '\x1f', "gzip file");
+    js.parse_compressed_file(path, 16);
+    check(js.dump() == expected.dump(), "parse_compressed_file of gzip");
+
+    // Cut in the header, the deflate stream and the trailer.
+    for (size_t cut : {size_t(5), size_t(12), packed.size() / 2,
+                       packed.size() - 8, packed.size() - 1}) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc)
+            << packed.substr(0, cut);
+        check(throws<std::runtime_error>(
+                  [&]() { js.parse_compressed_file(path, 16); }),
+              "truncated gzip");
+    }
+    // A flipped bit in the deflate stream, and in the crc of the trailer.
+    for (size_t at : {packed.size() / 2, packed.size() - 8}) {
+        std::string corrupt = packed;
+        corrupt[at] ^= 0x10;
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << corrupt;
+        check(throws<std::runtime_error>(
+                  [&]() { js.parse_compressed_file(path, 16); }),
+              "corrupt gzip");
+    }
+#endif
+    std::remove(path.c_str());
+}
+
+// s as a json string, escaped one byte at a time.
+static std::string
+escaped_string(const std::string &s) {
+    std::string q = "\"";
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            q += '\\';
+            q += c;
+        } else if (c == '\n') {
+            q += "\\n";
+        } else if (c == '\t') {
+            q += "\\t";
+        } else if (c < 0x20) {
+            char u[8];
+            snprintf(u, sizeof(u), "\\u%04x", c);
+            q += u;
+        } else {
+            q += c;
+        }
+    }
+    return q + "\"";
+}
+
+static void
+writer_test() {
+    std::string out;
+    ecl::json_writer w(out);
+    w.start_array();
+    w.string("q\"b\\s/\b\f\n\r\t\x01\x1f\x7f\xc3\xa9");
+    for (double d : {1.0, 100.0, -0.0, 0.1, 1.5e300, 5e-324, 1e21, 1e-7,
+                     0.30000000000000004, 123456789012345678.0})
+        w.float64(d);
+    w.float64(std::numeric_limits<double>::infinity());
+    w.float64(-std::numeric_limits<double>::infinity());
+    w.float64(std::nan(""));
+    w.int64(INT64_MIN);
+    w.uint64(UINT64_MAX);
+    w.end_array();
+    check(out == "[\"q\\\"b\\\\s/\\b\\f\\n\\r\\t\\u0001\\u001f\x7f\xc3\xa9\","
+                 "1.0,100.0,-0.0,0.1,1.5e+300,5e-324,1e+21,1e-07,"
+                 "0.30000000000000004,123456789012345680.0,null,null,null,"
+                 "-9223372036854775808,18446744073709551615]",
+          "written escapes and numbers");
+
+    // Escapes on either side of the 16 and 32-byte blocks of the vector
+    // scan, and runs with none.
+    for (size_t n : {15, 16, 31, 32, 33, 63, 64, 65, 100, 129}) {
+        for (size_t at : {size_t(0), size_t(15), size_t(16), size_t(31),
+                          size_t(32), size_t(63), size_t(64), n - 1, n}) {
+            for (char c : {'"', '\\', '\n', '\x01'}) {
+                std::string s(n, 'a');
+                for (size_t i = 0; i < n; ++i)
+                    s[i] = "abcdefghijklmnopqrstuvwxyz0123456789"[i % 36];
+                if (at < n)
+                    s[at] = c;
+                out.clear();
+                ecl::json_writer each(out);
+                each.string(s);
+                check(out == escaped_string(s), "escape in a long string");
+            }
+        }
+    }
+
+    // Layouts; empty containers stay on one line.
+    std::string text = "{\"a\":[],\"b\":{},\"c\":[1,{\"d\":null}],\"e\":\"x\"}";
+    ecl::json_storage js;
+    check(parses(js, text) && js.dump() == text, "compact layout");
+    check(js.dump(2) == "{\n"
+                        "  \"a\": [],\n"
+                        "  \"b\": {},\n"
+                        "  \"c\": [\n"
+                        "    1,\n"
+                        "    {\n"
+                        "      \"d\": null\n"
+                        "    }\n"
+                        "  ],\n"
+                        "  \"e\": \"x\"\n"
+                        "}",
+          "pretty layout");
+    check(parses(js, " [ ] ") && js.dump(4) == "[]", "empty top level");
+    check(parses(js, "[-7]") && js.dump(4) == "[\n    -7\n]",
+          "one element");
+    out = "x";
+    js.dump_to(out);
+    check(out == "x[-7]", "dump_to appends");
+
+#ifdef SLOWJSON_HAS_MMAP
+    // Through a file descriptor, flushed every 64 KiB, also in the middle
+    // of a long string.
+    text = "[";
+    for (int i = 0; i < 5000; ++i)
+        text += "{\"k\\t" + std::to_string(i) + "\":\"" +
+                std::string(i % 50, 'v') + "\"},";
+    text += "\"" + std::string(100000, 'w') + "\\n\"]";
+    check(parses(js, text), "document to write");
+    for (int indent : {0, 4}) {
+        std::string path = temporary_file("");
+        int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+        js.dump_to(fd, indent);
+        close(fd);
+        std::ifstream in(path, std::ios::binary);
+        std::string written((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+        check(written.size() > 2 * 65536 && written == js.dump(indent),
+              "dump_to a file descriptor");
+        std::remove(path.c_str());
+    }
+#endif
+}
+
+// Snapshots load only when whole, of this version and byte order, and
+// saved from the same text; a refused one leaves the storage as it was.
+static void
+snapshot_test() {
+    std::string text = "{\"a\":[1,2.5,18446744073709551615],"
+                       "\"b\":\"str\\n\",\"c\":{\"d\":null,\"e\":false}}";
+    uint64_t source = ecl::snapshot_format::fingerprint(text);
+    ecl::json_storage expected;
+    expected.read(text);
+    expected.parse_direct();
+    std::string image;
+    expected.snapshot_to(image);
+
+    ecl::json_storage js;
+    check(js.load_snapshot_view(image, source) && js.dump() == expected.dump(),
+          "snapshot round trip");
+    check(parses(js, "[\"kept\"]"), "tree before refused loads");
+    // Header: magic, version at 8, byte order at 12, source at 16,
+    // checksum at 40; nodes of 24 bytes follow.
+    auto patched = [&](size_t at, uint32_t value) {
+        std::string s = image;
+        memcpy(&s[at], &value, sizeof(value));
+        return s;
+    };
+    std::string flipped = image;
+    flipped[48 + 24 + 1] ^= 1;
+    std::string magic = image;
+    magic[0] = 'X';
+    for (const std::string &bad :
+         {patched(8, ecl::snapshot_format::version + 1),
+          patched(12, 0x04030201), magic, flipped,
+          image.substr(0, image.size() - 1), image.substr(0, 40),
+          std::string()}) {
+        check(!js.load_snapshot_view(bad, source), "damaged snapshot");
+        check(js.dump() == "[\"kept\"]", "storage kept after a refusal");
+    }
+    check(!js.load_snapshot_view(image, source + 1), "stale snapshot");
+    check(!js.load_snapshot_view(image, ecl::snapshot_format::fingerprint(
+                                            text + " ")),
+          "snapshot of other text");
+    check(js.dump() == "[\"kept\"]", "storage kept after a stale one");
+
+    // A link to an earlier node passes the checksum once it is fixed up,
+    // and is caught while building.
+    std::string backward = image;
+    uint32_t to = 1;
+    memcpy(&backward[48 + 24 * 3 + 8], &to, sizeof(to)); // next of 2.5
+    uint64_t sum = ecl::snapshot_format::hash(
+        std::string_view(backward).substr(48));
+    memcpy(&backward[40], &sum, sizeof(sum));
+    check(throws<std::runtime_error>(
+              [&]() { js.load_snapshot_view(backward, source); }),
+          "snapshot linking backward");
+
+    // Saved to and loaded from a file, mapped where possible.
+    std::string path = temporary_file("");
+    expected.save_snapshot(path);
+    check(js.load_snapshot(path, source) && js.dump() == expected.dump(),
+          "load_snapshot");
+    check(!js.load_snapshot(path, source + 1) &&
+              js.dump() == expected.dump(),
+          "load_snapshot of a stale file");
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << flipped;
+    check(!js.load_snapshot(path, source) && js.dump() == expected.dump(),
+          "load_snapshot of a damaged file");
+    std::remove(path.c_str());
+    check(!js.load_snapshot(path, source), "load_snapshot of no file");
+
+    // read_file_cached() writes the snapshot, loads it while the text is
+    // the same, and writes it anew once the text changes.
+    std::string json_path = temporary_file(text);
+    std::string snapshot_path = temporary_file("");
+    std::remove(snapshot_path.c_str());
+    js.read_file_cached(json_path, snapshot_path);
+    check(js.dump() == expected.dump(), "read_file_cached parses");
+    ecl::json_storage other;
+    other.read(std::string("{\"from\":\"snapshot\"}"));
+    other.parse_direct();
+    std::string decoy;
+    other.snapshot_to(decoy);
+    memcpy(&decoy[16], &source, sizeof(source)); // Not under the checksum
+    std::ofstream(snapshot_path, std::ios::binary | std::ios::trunc) << decoy;
+    js.read_file_cached(json_path, snapshot_path);
+    check(js.dump() == other.dump(), "read_file_cached loads the snapshot");
+    std::string changed = "[\"changed\"]";
+    std::ofstream(json_path, std::ios::binary | std::ios::trunc) << changed;
+    js.read_file_cached(json_path, snapshot_path);
+    check(js.dump() == "[\"changed\"]", "read_file_cached of changed text");
+    ecl::json_storage reloaded;
+    check(reloaded.load_snapshot(snapshot_path,
+                                 ecl::snapshot_format::fingerprint(changed)) &&
+              reloaded.dump() == "[\"changed\"]",
+          "read_file_cached rewrites the snapshot");
+    std::remove(json_path.c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+static void
+read_test() {
+    std::string text = "{\"a\":[";
+    for (int i = 0; i < 50000; ++i)
+        text += (i ? ",\"" : "\"") + std::to_string(i) + "\"";
+    text += "]}";
+    ecl::json_storage expected;
+    expected.read(text);
+    expected.parse_direct();
+
+    ecl::json_storage js;
+    std::string path = temporary_file(text); // Mapped
+    js.read_file(path);
+    js.parse_direct();
+    check(js.dump() == expected.dump(), "read_file");
+    std::remove(path.c_str());
+
+    path = temporary_file("");
+    js.read_file(path);
+    bool threw = false;
+    try {
+        js.parse_direct();
+    } catch (std::runtime_error &) {
+        threw = true;
+    }
+    check(threw, "empty file");
+    std::remove(path.c_str());
+
+    bool missing = false;
+    try {
+        js.read_file(path);
+    } catch (std::runtime_error &) {
+        missing = true;
+    }
+    check(missing, "missing file");
+
+#ifdef SLOWJSON_HAS_MMAP
+    // A pipe cannot be mapped: it is read in bulk, growing the buffer.
+    int fds[2];
+    if (pipe(fds) == 0) {
+        std::thread writer([&]() {
+            size_t done = 0;
+            while (done < text.size()) {
+                ssize_t n = write(fds[1], text.data() + done,
+                                  text.size() - done);
+                if (n <= 0)
+                    break;
+                done += n;
+            }
+            close(fds[1]);
+        });
+        js.read(fds[0]);
+        writer.join();
+        close(fds[0]);
+        js.parse_direct();
+        check(js.dump() == expected.dump(), "read from a pipe");
+    }
+#endif
+}
+
 int main()
 {
     ecl::json_storage js;
@@ -11,5 +1229,73 @@ int main()
     }"));
     js.tokenize();
     js.read_token_stream();
-    return 0;
-}
\ No newline at end of file
+    js.parse_direct();
+    ecl::json_tape tape;
+    js.parse_tape(tape);
+    js.load_tape(tape);
+    ecl::sax_handler ignore;
+    js.parse_sax(ignore);
+    js.read(js.dump(4));
+    if (!js.validate())
+        return 1;
+    js.parse_direct();
+    ecl::path_query query;
+    query.add("/test/noitem");
+    if (!js.query(query)[0].at(0).get<bool>())
+        return 1;
+    js.parse_direct();
+    doc bound;
+    js.parse_into(bound);
+    if (!bound.test.noitem ||
+        ecl::to_json(bound) != "{\"test\":{\"noitem\":true}}")
+        return 1;
+    std::string snapshot;
+    js.snapshot_to(snapshot);
+    ecl::json_storage reloaded;
+    if (!reloaded.load_snapshot_view(
+            snapshot, ecl::snapshot_format::fingerprint(js.dump(4))) ||
+        reloaded.dump() != js.dump())
+        return 1;
+    ecl::json_storage numbers;
+    numbers.set_lazy_numbers(true);
+    numbers.read(std::string("[12345678901234567890123, 1.50, -7]"));
+    numbers.parse_direct();
+    if (numbers.root().at(0).number_text() != "12345678901234567890123" ||
+        numbers.root().at(1).number_text() != "1.50" ||
+        numbers.root().at(1).get<double>() != 1.5 ||
+        numbers.root().at(2).get<int64_t>() != -7)
+        return 1;
+    ecl::compact_tree compact;
+    js.parse_compact(compact);
+    if (!compact.root()["test"]["noitem"].get<bool>())
+        return 1;
+    if (!js.root()["test"]["noitem"].get<bool>())
+        return 1;
+#ifdef SLOWJSON_STATS
+    const ecl::parse_stats &stats = js.stats();
+    if (stats.calls[ecl::parse_stats::PHASE_PARSE] == 0 ||
+        stats.tokens[ecl::COLON] == 0 || stats.nodes == 0 ||
+        stats.max_depth != 2)
+        return 1;
+#endif
+    unescape_test();
+    read_test();
+    compressed_test();
+    writer_test();
+    snapshot_test();
+    number_test();
+    accessor_test();
+    key_pool_test();
+    bind_test();
+    tape_test();
+    sax_test();
+    compact_test();
+    feed_test();
+    lazy_test();
+    lazy_numbers_test();
+    query_test();
+#ifdef SLOWJSON_STATS
+    stats_test();
+#endif
+    return failures ? 1 : 0;
+}